@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compare two kilo -b result files: compare.sh baseline.tsv results.tsv
+# A benchmark that appears more than once counts with its fastest run.
+# Prints each benchmark with its change against the baseline and exits 1
+# when anything got slower by more than TOLERANCE percent (default 10).
+# Benchmarks under 1 ms are shown but never count as regressions.
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 baseline.tsv results.tsv" >&2
+    exit 2
+fi
+
+awk -F '\t' -v tol="${TOLERANCE:-10}" '
+    NR == FNR {
+        key = $1 "\t" $2
+        if (!(key in base) || $3 < base[key]) base[key] = $3
+        next
+    }
+    {
+        key = $1 "\t" $2
+        if (!(key in cur)) order[n++] = key
+        if (!(key in cur) || $3 < cur[key]) cur[key] = $3
+    }
+    END {
+        for (i = 0; i < n; i++) {
+            key = order[i]
+            split(key, f, "\t")
+            if (!(key in base)) { printf "%-40s %-8s %10.3f ms  (new)\n", f[1], f[2], cur[key]; continue }
+            change = base[key] > 0 ? (cur[key] - base[key]) * 100 / base[key] : 0
+            flag = ""
+            if (change > tol && cur[key] >= 1) { flag = "  REGRESSION"; bad++ }
+            printf "%-40s %-8s %10.3f ms %+7.1f%%%s\n", f[1], f[2], cur[key], change, flag
+        }
+        exit bad > 0
+    }
+' "$1" "$2"
@@ -0,0 +1,123 @@
+/*
+ * Reproducible synthetic corpora for make bench-io.
+ *
+ *   gencorpus log|json|csv|utf8 SIZE [SEED] > file
+ *
+ * SIZE is in bytes, with an optional K, M or G suffix. The same kind, size
+ * and seed always give the same bytes. About one line in 1000 contains
+ * NEEDLE, for the search benchmark.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t state;
+
+/*
+ * xorshift64*, good enough for test data and the same on every platform
+ */
+static uint64_t rnd() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+static unsigned long long written;
+
+/*
+ * fprintf that keeps count, since ftell fails when stdout is a pipe
+ */
+static void emit(FILE *fp, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vfprintf(fp, fmt, ap);
+    va_end(ap);
+    if (len > 0) written += len;
+}
+
+static int pick(int n) { return (int)(rnd() % (uint64_t)n); }
+
+static const char *words[] = {"request", "cache", "miss", "user", "session", "timeout", "retry", "shard",
+                              "index", "buffer", "flush", "commit", "stream", "token", "window", "scroll"};
+
+static const char *utf8words[] = {"héllo", "wörld", "ça", "naïve", "世界", "日本語", "данные", "Ελλάδα",
+                                  "🙂", "→", "€", "ü", "plain", "ascii", "text", "mixed"};
+
+#define NWORDS(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static void line_log(FILE *fp, long n) {
+    static const char *levels[] = {"INFO ", "DEBUG", "WARN ", "ERROR"};
+    emit(fp, "2024-%02d-%02dT%02d:%02d:%02d.%03dZ %s [worker-%02d] %s %s id=%08x path=/api/v1/%s/%d status=%d dur=%dms%s\n",
+         1 + pick(12), 1 + pick(28), pick(24), pick(60), pick(60), pick(1000), levels[pick(4)], pick(32),
+         words[pick(NWORDS(words))], words[pick(NWORDS(words))], (unsigned)rnd(), words[pick(NWORDS(words))],
+         pick(100000), pick(5) ? 200 : 500, pick(2000), n % 1000 == 999 ? " NEEDLE" : "");
+}
+
+static void line_json(FILE *fp, long n) {
+    int i, fields = 40 + pick(160);
+    emit(fp, "{\"id\":%ld,\"kind\":\"%s\"", n, n % 1000 == 999 ? "NEEDLE" : words[pick(NWORDS(words))]);
+    for (i = 0; i < fields; i++) {
+        if (pick(3) == 0)
+            emit(fp, ",\"%s_%d\":%d", words[pick(NWORDS(words))], i, pick(1000000));
+        else
+            emit(fp, ",\"%s_%d\":\"%s %s\"", words[pick(NWORDS(words))], i, words[pick(NWORDS(words))],
+                 words[pick(NWORDS(words))]);
+    }
+    emit(fp, "}\n");
+}
+
+static void line_csv(FILE *fp, long n) {
+    if (n == 0) {
+        emit(fp, "id,name,email,amount,date,note\n");
+        return;
+    }
+    emit(fp, "%ld,%s %s,%s%d@example.com,%d.%02d,2024-%02d-%02d,%s\n", n, words[pick(NWORDS(words))],
+         words[pick(NWORDS(words))], words[pick(NWORDS(words))], pick(10000), pick(100000), pick(100), 1 + pick(12),
+         1 + pick(28), n % 1000 == 999 ? "NEEDLE" : words[pick(NWORDS(words))]);
+}
+
+static void line_utf8(FILE *fp, long n) {
+    int i, count = 6 + pick(20);
+    for (i = 0; i < count; i++)
+        emit(fp, "%s%s", i ? " " : "", pick(2) ? utf8words[pick(NWORDS(utf8words))] : words[pick(NWORDS(words))]);
+    emit(fp, "%s\n", n % 1000 == 999 ? " NEEDLE" : "");
+}
+
+int main(int argc, char *argv[]) {
+    void (*line)(FILE *, long);
+    unsigned long long size;
+    char *end;
+    long n;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: gencorpus log|json|csv|utf8 SIZE [SEED]\n");
+        return 2;
+    }
+    if (!strcmp(argv[1], "log"))
+        line = line_log;
+    else if (!strcmp(argv[1], "json"))
+        line = line_json;
+    else if (!strcmp(argv[1], "csv"))
+        line = line_csv;
+    else if (!strcmp(argv[1], "utf8"))
+        line = line_utf8;
+    else {
+        fprintf(stderr, "gencorpus: unknown kind %s\n", argv[1]);
+        return 2;
+    }
+    size = strtoull(argv[2], &end, 10);
+    if (*end == 'K' || *end == 'k') size <<= 10;
+    if (*end == 'M' || *end == 'm') size <<= 20;
+    if (*end == 'G' || *end == 'g') size <<= 30;
+    state = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    state = state * 0x9e3779b97f4a7c15ULL + 1;  // never 0, which xorshift can't leave
+
+    static char buf[1 << 20];
+    setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+    for (n = 0; written < size; n++) line(stdout, n);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
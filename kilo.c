@@ -1,16 +1,39 @@
 /*** includes ***/
 
+/*
+ * Feature test macros, so getline() and memmem() are declared even though we
+ * compile with -std=c99. They have to come before any header is included.
+ */
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 /*
  * These standard headers are needed for basic system and terminal manipulation:
  */
 
 #include <ctype.h>      // iscntrl(), checks for control characters like Ctrl-C
+#include <dirent.h>     // opendir(), readdir()
 #include <errno.h>      // errno variable and error codes
-#include <stdio.h>      // printf(), perror()
+#include <fcntl.h>      // open(), O_RDONLY
+#include <fnmatch.h>    // fnmatch(), for .gitignore patterns
+#include <limits.h>     // INT_MAX, PATH_MAX
+#include <poll.h>       // poll(), to wait on the keyboard and child pipes at once
+#include <signal.h>     // signal(), kill(), SIGPIPE
+#include <stdarg.h>     // va_list, for editorSetStatusMessage()
+#include <stdint.h>     // uint64_t
+#include <stdio.h>      // printf(), perror(), getline()
 #include <stdlib.h>     // exit(), atexit()
 #include <string.h>     //memcpy()
+#include <strings.h>    // strncasecmp()
 #include <sys/ioctl.h>  // TIOCGWINSZ (Terminal IOCtl Get WINdow SiZe)
+#include <sys/mman.h>   // mmap()
+#include <sys/stat.h>   // fstat()
+#include <sys/types.h>  // ssize_t
+#include <sys/uio.h>    // writev()
+#include <sys/wait.h>   // waitpid()
 #include <termios.h>    // terminal I/O interfaces (tcgetattr(), tcsetattr())
+#include <time.h>       // time(), to let status messages expire
 #include <unistd.h>     // read(), STDIN_FILENO
 
 /*** defines ***/
@@ -28,232 +51,6367 @@
 #define CTRL_KEY(letter) ((letter) & 0x1f)
 #define RYEDOC_VERSION "0.0.1"
 
-/*** data ***/
+/*
+ * Number of lines the filter scans between two screen refreshes, so matches
+ * in a huge file show up while the rest of it is still being searched.
+ */
+#define FILTER_BATCH 65536
 
 /*
- * Store the original terminal settings here so we can restore them later
- * when the program exits or crashes. This prevents the terminal from staying
- * in raw mode after quitting the editor.
+ * Rows per leaf of the bracket matching tree. A jump scans at most two
+ * chunks row by row, everything in between is skipped through the tree.
+ * Inserted rows grow a chunk up to twice this before it is split.
  */
-struct editorConfig {
-    int cx, cy;
-    int screenrows;
-    int screencols;
-    struct termios orig_termios;
+#define BRACKET_CHUNK 64
+
+/*
+ * Give up on the diff search past this many edits and call what is left a
+ * replaced block, so diffing against an unrelated file can't hang the editor.
+ */
+#define DIFF_MAX_COST 4096
+
+/*
+ * How many candidates Ctrl-N cycles through
+ */
+#define COMPLETE_MAX 10
+
+/*
+ * Project search: redraw the results after this many files,
+ * and keep at most this many bytes of each matching line.
+ */
+#define GREP_REFRESH 256
+#define GREP_TEXT_MAX 256
+
+/*
+ * How many tag jumps Ctrl-T can go back through
+ */
+#define TAG_STACK_MAX 32
+
+/*
+ * Widest line number column, the space after the number included
+ */
+#define GUTTER_MAX 16
+
+/*
+ * Minimap: braille cells wide (two dot columns each), and line bytes per dot
+ */
+#define MINIMAP_COLS 8
+#define MINIMAP_DOT 5
+
+/*
+ * Rows per leaf of the minimap tree. A dot row reads the lengths of at most
+ * two chunks one by one.
+ */
+#define MINIMAP_CHUNK 64
+
+/*
+ * How many of the latest trace spans are kept, a power of two
+ */
+#define TRACE_EVENTS 65536
+
+/*
+ * Latency histogram buckets: 16 exact ones, then 16 per power of two up to 2^41us
+ */
+#define LATENCY_BUCKETS (16 + 38 * 16)
+
+/*
+ * Line sorting insertion sorts runs this long before merging them
+ */
+#define SORT_RUN 16
+
+/*
+ * Yank registers: the unnamed one, then a to z.
+ */
+#define REGISTERS 27
+
+/*
+ * Reference counts of shared rows are allocated this many at a time.
+ */
+#define REFS_CHUNK 65536
+
+/*
+ * Moving lines sets aside the smaller block when it has at most this many
+ * rows. Bigger ones are rotated in place, see editorRotateRows().
+ */
+#define ROTATE_BUFFER 65536
+
+/*
+ * Keys that arrive as escape sequences get values outside of the char range,
+ * so they can never be confused with a normal keypress.
+ */
+enum editorKey {
+    BACKSPACE = 127,
+    ARROW_LEFT = 1000,
+    ARROW_RIGHT,
+    ARROW_UP,
+    ARROW_DOWN,
+    DEL_KEY,
+    HOME_KEY,
+    END_KEY,
+    PAGE_UP,
+    PAGE_DOWN
 };
 
-struct editorConfig E;
+/*
+ * Normal mode moves around with hjkl and runs commands,
+ * insert mode ('i' to enter, Esc to leave) types into the buffer.
+ */
+enum editorMode { MODE_NORMAL, MODE_INSERT };
 
-/*** terminal ***/
+/*** call counting ***/
 
 /*
- * die() prints an error message and exits.
- * It uses perror() to describe the most recent system call failure.
+ * make kilo-count builds with -DKILO_COUNT. Then every malloc, calloc,
+ * realloc, strdup, free, read, write and writev in this file goes through
+ * a wrapper that counts calls and bytes against the current phase:
+ * startup, handling keys or drawing frames. Files are loaded with stdio,
+ * so a getline() call counts as a read of the line it returns. The totals
+ * are reported on stderr at exit, and editorCountAssert() lets kilo -b
+ * fail when, say, redrawing an unchanged screen allocates. What stdio does
+ * inside libc, its own read(2) calls and buffers, is not seen. In a normal
+ * build the hooks compile to nothing.
  */
-void die(const char *s) {
-    // Clear screen on exit
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
 
-    perror(s);
+enum countPhase { COUNT_STARTUP = 0, COUNT_KEY, COUNT_FRAME, COUNT_PHASES };
+
+#ifdef KILO_COUNT
+
+struct callCount {
+    unsigned long long events;  // keys handled or frames drawn
+    unsigned long long allocs, allocbytes, frees;
+    unsigned long long reads, readbytes, writes, writebytes;
+};
+
+struct callCounts {
+    int phase;
+    struct callCount c[COUNT_PHASES];
+    struct callCount mark;  // counts of the phase at the last editorCountMark()
+} counts;
+
+void *editorCountMalloc(size_t size) {
+    counts.c[counts.phase].allocs++;
+    counts.c[counts.phase].allocbytes += size;
+    return malloc(size);
+}
+
+void *editorCountCalloc(size_t n, size_t size) {
+    counts.c[counts.phase].allocs++;
+    counts.c[counts.phase].allocbytes += n * size;
+    return calloc(n, size);
+}
+
+void *editorCountRealloc(void *p, size_t size) {
+    counts.c[counts.phase].allocs++;
+    counts.c[counts.phase].allocbytes += size;
+    return realloc(p, size);
+}
+
+char *editorCountStrdup(const char *s) {
+    counts.c[counts.phase].allocs++;
+    counts.c[counts.phase].allocbytes += strlen(s) + 1;
+    return strdup(s);
+}
+
+void editorCountFree(void *p) {
+    if (p) counts.c[counts.phase].frees++;
+    free(p);
+}
+
+ssize_t editorCountRead(int fd, void *buf, size_t n) {
+    ssize_t r = read(fd, buf, n);
+    counts.c[counts.phase].reads++;
+    if (r > 0) counts.c[counts.phase].readbytes += r;
+    return r;
+}
+
+ssize_t editorCountGetline(char **line, size_t *cap, FILE *fp) {
+    ssize_t r = getline(line, cap, fp);
+    counts.c[counts.phase].reads++;
+    if (r > 0) counts.c[counts.phase].readbytes += r;
+    return r;
+}
+
+ssize_t editorCountWrite(int fd, const void *buf, size_t n) {
+    ssize_t r = write(fd, buf, n);
+    counts.c[counts.phase].writes++;
+    if (r > 0) counts.c[counts.phase].writebytes += r;
+    return r;
+}
+
+ssize_t editorCountWritev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t r = writev(fd, iov, iovcnt);
+    counts.c[counts.phase].writes++;
+    if (r > 0) counts.c[counts.phase].writebytes += r;
+    return r;
+}
+
+#define malloc(size) editorCountMalloc(size)
+#define calloc(n, size) editorCountCalloc(n, size)
+#define realloc(p, size) editorCountRealloc(p, size)
+#define strdup(s) editorCountStrdup(s)
+#define free(p) editorCountFree(p)
+#define read(fd, buf, n) editorCountRead(fd, buf, n)
+#define getline(line, cap, fp) editorCountGetline(line, cap, fp)
+#define write(fd, buf, n) editorCountWrite(fd, buf, n)
+#define writev(fd, iov, iovcnt) editorCountWritev(fd, iov, iovcnt)
+
+/*
+ * Charge what follows to phase, one more key or frame.
+ */
+void editorCountPhase(int phase) {
+    counts.phase = phase;
+    counts.c[phase].events++;
+}
+
+/*
+ * Remember the current phase's counts, for editorCountAssert().
+ */
+void editorCountMark() { counts.mark = counts.c[counts.phase]; }
+
+/*
+ * Exit with an error if the current phase made more than allocs
+ * allocations or writes writes since editorCountMark().
+ */
+void editorCountAssert(const char *what, unsigned long long allocs, unsigned long long writes) {
+    struct callCount *c = &counts.c[counts.phase];
+    unsigned long long a = c->allocs - counts.mark.allocs, w = c->writes - counts.mark.writes;
+
+    if (a <= allocs && w <= writes) return;
+    fprintf(stderr, "%s: %llu allocations (at most %llu), %llu writes (at most %llu)\n", what, a, allocs, w, writes);
     exit(1);
 }
 
 /*
- * disableRawMode() restores the terminal settings to their original state.
- * This gets registered with atexit() so it's called when the program exits,
- * even if it crashes or exits early.
+ * Registered with atexit() before raw mode, so it runs after the terminal is back to normal.
  */
-void disableRawMode() {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) die("tcsetattr");
+void editorCountReport() {
+    static const char *names[] = {"startup", "keys", "frames"};
+    int i;
+
+    fprintf(stderr, "%-8s %8s %10s %12s %10s %10s %12s %10s %12s\n", "phase", "events", "allocs", "alloc bytes",
+            "frees", "reads", "read bytes", "writes", "write bytes");
+    for (i = 0; i < COUNT_PHASES; i++) {
+        struct callCount *c = &counts.c[i];
+        fprintf(stderr, "%-8s %8llu %10llu %12llu %10llu %10llu %12llu %10llu %12llu\n", names[i], c->events,
+                c->allocs, c->allocbytes, c->frees, c->reads, c->readbytes, c->writes, c->writebytes);
+    }
 }
 
+#else
+
+#define editorCountPhase(phase) ((void)0)
+#define editorCountMark() ((void)0)
+#define editorCountAssert(what, allocs, writes) ((void)0)
+
+void editorCountReport() {}
+
+#endif
+
+/*** append buffer ***/
+
 /*
- * enableRawMode() puts the terminal into "raw mode", turning off features like
- * line buffering, echo, signal generation, etc. This is needed for real-time
- * key input handling in a text editor.
+ * Replace write() calls with code that appends the string to a buffer, then writes
+ * Prevents flicker affect with multiple write calls for all the ~ and whatever we are typing
  */
-void enableRawMode() {
-    // Get the current terminal attributes and store them for later restoration
-    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcgetattr");
 
-    // Ensure disableRawMode() is called on program exit
-    atexit(disableRawMode);
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+};
 
-    struct termios raw = E.orig_termios;
+#define ABUF_INIT {NULL, 0, 0}
 
-    /*
-     * Input flags (c_iflag):
-     *  - BRKINT: disable Ctrl-C generating a SIGINT when break condition is detected
-     *  - ICRNL: disable conversion of CR to NL (allows raw handling of Enter)
-     *  - INPCK and ISTRIP: legacy/rare input features, we disable them for raw
-     *  - IXON: disable software flow control (Ctrl-S, Ctrl-Q)
-     */
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+/*
+ * Make sure there is room for len more bytes, doubling the allocation when
+ * there isn't, so appending a byte at a time costs O(1) amortized instead of
+ * a realloc() per call. A buffer emptied with len = 0 keeps its memory.
+ * Use memcpy copy the string after end of current data in buffer then update *ptr and len
+ */
+void abAppend(struct abuf *ab, const char *s, int len) {
+    if (len <= 0) return;
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap : 64;
+        while (cap < ab->len + len) cap *= 2;
+        char *new = realloc(ab->b, cap);
+        if (new == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(&ab->b[ab->len], s, len);
+    ab->len += len;
+}
+/*
+ * Free our struct after we are done, always clean your messes
+ */
+void abFree(struct abuf *ab) { free(ab->b); }
 
-    /*
-     * Output flags (c_oflag):
-     *  - OPOST: disable all post-processing of output (e.g., converting `\n` to `\r\n`)
-     */
-    raw.c_oflag &= ~(OPOST);
+/*** data ***/
+
+/*
+ * One line of the file. chars is always '\0' terminated, size does not count it.
+ */
+typedef struct erow {
+    int size;
+    int hashed;
+    char *chars;
+    uint64_t hash;          // of chars, for the diff; only valid while hashed is set
+    int *refs;              // holders of chars when yank registers share it, else NULL
+    int words, codepoints;  // as counted by editorStatsCount()
+} erow;
+
+/*
+ * Where erow.refs points: a count while in use, a free list link after.
+ */
+union refSlot {
+    int count;
+    union refSlot *next;
+};
+
+/*
+ * A filtered view is a secondary index of line numbers into E.row holding
+ * only the lines that contain pattern. Nothing gets copied: the rows on
+ * screen are the real rows, so edits made in the view land in the document.
+ * While the view is active E.cy is an index into lines, not a file line.
+ */
+struct filterView {
+    int active;
+    int *lines;
+    int len;
+    int cap;
+    char *pattern;
+};
+
+/*
+ * One line of the pretty-printed JSON layout: where it starts in the source
+ * text, how far it is indented, and for a folded object/array the offset of
+ * its closing bracket (-1 when not folded).
+ */
+struct jsonLine {
+    int start;
+    int depth;
+    int foldend;
+};
+
+/*
+ * Pretty-printed view of a (usually minified, single line) JSON row.
+ * The layout is only computed as far down as the user has scrolled:
+ * next/nextdepth say where the first line not laid out yet begins.
+ * folds holds the start offsets of the lines whose object/array is folded.
+ * text is one screen line wide, for drawing a line into.
+ */
+struct jsonView {
+    int active;
+    int line;  // the file row holding the JSON text
+    struct jsonLine *lines;
+    int len;
+    int cap;
+    int next;
+    int nextdepth;
+    int *folds;
+    int nfolds;
+    char *text;
+};
+
+/*
+ * A folded range in the fold treap, see the folding section: line start
+ * stays visible, start+1..end are hidden. Positions are relative, so a
+ * node only knows the lines between it and the fold before.
+ */
+struct foldNode {
+    int gap;    // start - end of the previous fold (or line 0)
+    int len;    // end - start, the lines hidden
+    int span;   // gap + len over the subtree
+    int hid;    // len over the subtree
+    int prio;   // heap order of the treap
+    int left;   // children, 0 for none (node 0 is the empty tree)
+    int right;
+};
+
+struct foldSet {
+    struct foldNode *n;
+    int root;
+    int len;   // folds in the tree
+    int used;  // nodes handed out, free ones chained through left
+    int cap;
+    int free;
+};
+
+/*
+ * Segment tree for bracket matching, see the bracket matching section.
+ * The leaves are chunks of about BRACKET_CHUNK rows. rows sums their row
+ * counts, net and min hold 3 trees (one per bracket kind), all of 2 * size
+ * nodes. A dirty chunk came from a range edit and is summed up on the next
+ * jump, stale says there is one. valid is cleared when a file is loaded.
+ * mask is the code mask of the row being scanned, reused for the next one.
+ */
+struct bracketChunk {
+    int rows;
+    int dirty;
+    int net[3];
+    int min[3];
+};
+
+struct bracketIndex {
+    int valid;
+    int stale;
+    struct bracketChunk *chunks;
+    int len;
+    int cap;
+    int size;
+    int *rows;
+    int *net;
+    int *min;
+    char *mask;
+    int maskcap;
+};
+
+/*
+ * Chunks of lines for the minimap, see the minimap section, and a tree of
+ * 2 * size nodes over them holding row counts and the longest line.
+ * valid is cleared when a file is loaded.
+ */
+struct minimapChunk {
+    int rows;
+    int max;
+    int dirty;
+};
+
+struct minimap {
+    int show;
+    int valid;
+    struct minimapChunk *chunks;
+    int len;
+    int cap;
+    int size;
+    int *rows;
+    int *max;
+};
+
+/*
+ * Diff gutter state. old holds the line hashes of the file we compare
+ * against, marks one gutter character per buffer line. computed is the
+ * value of E.dirty the marks were computed for. map gives the line of old
+ * each of the nmap buffer lines was matched with, -1 for added lines;
+ * mapped says it is there. Lines lo..hi-1 changed since, and the buffer
+ * grew by shift lines, so map still describes the lines around them.
+ */
+struct diffState {
+    int active;
+    char *against;
+    uint64_t *old;
+    int nold;
+    char *marks;
+    int computed;
+    int *map;
+    int nmap;
+    int mapped;
+    int changed;
+    int lo;
+    int hi;
+    int shift;
+};
+
+/*
+ * A file shown by the side by side diff: mmap'd, with the offset where each
+ * line starts (starts[nlines] is the file size) and each line's hash.
+ */
+struct sbsFile {
+    char *map;
+    size_t size;
+    size_t *starts;
+    uint64_t *hashes;
+    int nlines;
+};
+
+/*
+ * A run of aligned rows: na lines of a from line a next to nb lines of b
+ * from line b, either equal or a changed block. row is its first row on screen.
+ */
+struct sbsRun {
+    int a, b;
+    int na, nb;
+    int changed;
+    int row;
+};
+
+struct sbsState {
+    int active;
+    struct sbsFile a;
+    struct sbsFile b;
+    struct sbsRun *runs;
+    int nruns;
+    int cap;
+    int nrows;  // aligned rows in total
+};
+
+/*
+ * Completion index: every identifier in the buffer, sorted, with its count.
+ */
+struct wordEntry {
+    char *word;
+    int count;
+};
+
+struct wordIndex {
+    int built;
+    struct wordEntry *w;
+    int len;
+    int cap;
+};
+
+/*
+ * State of a run of Ctrl-N presses: the word being completed starts at
+ * column start, typed bytes of it were typed by the user, cands[idx] is
+ * the candidate currently inserted.
+ */
+struct completion {
+    int active;
+    int start;
+    int typed;
+    char *cands[COMPLETE_MAX];
+    int n;
+    int idx;
+};
+
+/*
+ * Every file under the current directory, for the file picker: paths are
+ * '\0' terminated strings packed in arena, off[i] is where path i starts,
+ * mask[i] the characters it contains (see editorCharMask()).
+ */
+struct fileIndex {
+    int built;
+    char *arena;
+    size_t used;
+    size_t arenacap;
+    size_t *off;
+    uint64_t *mask;
+    int n;
+    int cap;
+    char **ignore;  // .gitignore patterns
+    int nignore;
+};
+
+/*
+ * File picker state: matches are the files matching query, results the
+ * best of them (as many as fit on screen) sorted by score, sel the
+ * highlighted one.
+ */
+struct picker {
+    int active;
+    char *query;
+    int *matches;
+    int nmatches;
+    int *results;
+    int *scores;
+    int nresults;
+    int sel;
+};
+
+/*
+ * One project search hit: file is an index into E.files, text an offset
+ * into the results' arena where a copy of the line is kept.
+ */
+struct grepResult {
+    int file;
+    int line;
+    int col;
+    size_t text;
+};
+
+/*
+ * Project search results. The cursor of the buffer is kept aside in
+ * saved* while the results list is on screen.
+ */
+struct grepState {
+    int active;
+    char *pattern;
+    struct grepResult *r;
+    int n;
+    int cap;
+    char *arena;
+    size_t used;
+    size_t arenacap;
+    int savedcx, savedcy, savedrowoff;
+};
+
+/*
+ * The mmap'd tags file and the positions tag jumps were made from.
+ */
+struct tagPos {
+    char *filename;
+    int line;
+    int col;
+};
+
+struct tagState {
+    const char *map;
+    size_t size;
+    struct tagPos stack[TAG_STACK_MAX];
+    int depth;
+};
+
+/*
+ * Running totals over all rows for W, see the statistics section.
+ * chars are codepoints. The '\n' of each line is added when shown.
+ */
+struct docStats {
+    int show;
+    long long words;
+    long long chars;
+    long long bytes;
+};
+
+/*
+ * Spell checking dictionary, see the spell checking section. slots hold
+ * offsets + 1 of words in map, bloom has bloombits bits. bad and code are
+ * per byte marks for the row being drawn, kept to draw the next one.
+ */
+struct spellDict {
+    int loaded;
+    int show;
+    char *map;
+    size_t size;
+    uint32_t *slots;
+    uint32_t mask;
+    uint64_t *bloom;
+    uint32_t bloombits;
+    char *bad;
+    char *code;
+    int rowcap;
+};
+
+/*
+ * Language server connection. out holds bytes not written to the server
+ * yet (from sent on), in bytes read but not yet parsed, changes the
+ * contentChanges of the didChange being built for the current keypress.
+ */
+struct lspState {
+    pid_t pid;
+    int to;
+    int from;
+    int opened;
+    char *uri;
+    int version;
+    int nextid;
+    struct abuf out;
+    int sent;
+    struct abuf in;
+    struct abuf changes;
+    int received;
+    int diagnostics;
+};
+
+/*
+ * A command the buffer (or the closed fold under the cursor) is being piped
+ * through. Lines start..end are written straight from the rows, line/off is
+ * how far that got; the output collects in buf until the command exits.
+ */
+struct pipeState {
+    pid_t pid;
+    int to;
+    int from;
+    int start;
+    int end;
+    int line;
+    int off;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/*
+ * The number a line starts with, as digits, for sorting with N.
+ */
+struct numKey {
+    int neg;
+    const char *digits;
+    int ilen;
+    const char *frac;
+    int flen;
+};
+
+/*
+ * Lines yanked with y or :y, see editorYank(). The rows share their text
+ * with the buffer.
+ */
+struct yankRegister {
+    erow *lines;
+    int len;
+};
+
+/*
+ * What editorSortRange() does to the lines, in one pass: sort them (by
+ * bytes, or by number), reverse the result, drop repeated lines.
+ */
+enum sortFlags { SORT_LINES = 1, SORT_NUMERIC = 2, SORT_REVERSE = 4, SORT_UNIQUE = 8 };
+
+/*
+ * A line as the sort moves it around: a pointer to its row plus a
+ * 64 bit key that settles most comparisons, see editorSortKey().
+ */
+struct sortRef {
+    uint64_t key;
+    erow *row;
+};
+
+/*
+ * One piece of the status bar. in holds what text was last made from, so
+ * it only gets formatted again when one of those inputs changed.
+ */
+struct statusSegment {
+    int made;
+    long long in[5];
+    int len;
+    char text[96];
+};
+
+enum statusSegmentId { SEG_FILE, SEG_MODE, SEG_LSP, SEG_STATS, SEG_POS, SEG_COUNT };
+
+struct statusBar {
+    struct statusSegment seg[SEG_COUNT];
+    char msg[80];
+    time_t msgtime;
+};
+
+/*
+ * Ring of the last TRACE_EVENTS spans, count is how many were ever recorded.
+ * Times are CLOCK_MONOTONIC nanoseconds.
+ */
+struct traceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+};
+
+struct tracer {
+    struct traceEvent ev[TRACE_EVENTS];
+    unsigned long long count;
+};
+
+/*
+ * Keystroke to photon times in microseconds, see the latency section.
+ * keyat is when the key waiting to be shown was read, 0 if none is.
+ */
+struct latency {
+    int on;
+    uint64_t keyat;
+    unsigned long long count;
+    uint64_t max;
+    unsigned long long buckets[LATENCY_BUCKETS];
+};
+
+/*
+ * Store the original terminal settings here so we can restore them later
+ * when the program exits or crashes. This prevents the terminal from staying
+ * in raw mode after quitting the editor.
+ */
+struct editorConfig {
+    int cx, cy;
+    int rowoff;  // first visible row, for vertical scrolling
+    int coloff;  // first visible column, for horizontal scrolling
+    int screenrows;
+    int screencols;
+    int gutter;    // columns left of the text taken by line numbers and diff marks
+    int numbers;   // line numbers: 0 off, 1 absolute, 2 relative to the cursor
+    int numwidth;  // columns of the line numbers this frame, 0 when not shown
+    int mapwidth;  // columns right of the text taken by the minimap, 0 when not shown
+    uint64_t *drawn;    // hash of each screen row as last written, see editorDrawLine()
+    char *gutterdrawn;  // GUTTER_MAX cells per screen row as last written
+    int drawnvalid;     // 0 until the whole screen has been drawn once
+    struct abuf frame;  // the escape sequences of a frame, kept from one frame to the next
+    struct abuf line;   // one screen row being built, see editorDrawLine()
+    int numrows;
+    int rowcap;  // allocated slots in row, grows by doubling
+    erow *row;
+    int mode;
+    int dirty;
+    char *filename;
+    char *prompt;  // shown on the last screen row while editorPrompt() runs
+    struct filterView view;
+    struct yankRegister regs[REGISTERS];
+    union refSlot *freerefs;  // see editorRefAlloc()
+    struct jsonView json;
+    struct foldSet folds;
+    struct bracketIndex brackets;
+    struct minimap minimap;
+    struct diffState diff;
+    struct sbsState sbs;
+    struct wordIndex words;
+    struct completion complete;
+    struct fileIndex files;
+    struct picker picker;
+    struct grepState grep;
+    struct tagState tags;
+    struct docStats stats;
+    struct statusBar status;
+    struct spellDict spell;
+    struct lspState lsp;
+    struct pipeState pipe;
+    struct tracer trace;
+    struct latency latency;
+    struct termios orig_termios;
+};
+
+struct editorConfig E;
+
+/*** prototypes ***/
+
+void editorRefreshScreen();
+char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorSetStatusMessage(const char *fmt, ...);
+void editorDrawText(struct abuf *ab, const char *s, int len);
+void editorWaitKey();
+void editorInsertChar(int c);
+void editorDelChar();
+void editorSetScreenSize(int rows, int cols);
+
+/*** tracing ***/
+
+/*
+ * Every keypress and frame leaves a few spans in a ring of the last
+ * TRACE_EVENTS: waiting for the key, handling it, the diff refresh,
+ * building the frame and writing it. Recording one is a clock read and
+ * three stores, cheap enough to leave on. T writes the ring out in Chrome
+ * trace format ($KILO_TRACE, else kilo-trace.json), to be opened in
+ * chrome://tracing or Perfetto when typing feels slow.
+ */
+
+uint64_t editorTraceNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Record a span named name from start (an editorTraceNow()) until now.
+ * name must be a string literal, only the pointer is kept.
+ */
+void editorTraceSpan(const char *name, uint64_t start) {
+    struct traceEvent *ev = &E.trace.ev[E.trace.count++ % TRACE_EVENTS];
+    ev->name = name;
+    ev->start = start;
+    ev->dur = editorTraceNow() - start;
+}
+
+void editorTraceExport() {
+    const char *path = getenv("KILO_TRACE");
+    unsigned long long i, first = E.trace.count > TRACE_EVENTS ? E.trace.count - TRACE_EVENTS : 0;
+    FILE *fp;
+
+    if (path == NULL) path = "kilo-trace.json";
+    if ((fp = fopen(path, "w")) == NULL) {
+        editorSetStatusMessage("Can't write trace: %s", strerror(errno));
+        return;
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (i = first; i < E.trace.count; i++) {
+        struct traceEvent *ev = &E.trace.ev[i % TRACE_EVENTS];
+        // timestamps are in microseconds, keep the nanoseconds as decimals
+        fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}\n",
+                i == first ? "" : ",", ev->name, (unsigned long long)(ev->start / 1000),
+                (unsigned long long)(ev->start % 1000), (unsigned long long)(ev->dur / 1000),
+                (unsigned long long)(ev->dur % 1000));
+    }
+    fprintf(fp, "]}\n");
+    if (fclose(fp) == 0)
+        editorSetStatusMessage("%llu trace events written to %s", E.trace.count - first, path);
+    else
+        editorSetStatusMessage("Can't write trace: %s", strerror(errno));
+}
+
+/*** latency ***/
+
+/*
+ * With $KILO_LATENCY set, each key is timed from the moment read() hands
+ * it over to the moment the write() of the frame showing it returns, and
+ * the times go into a histogram reported on stderr at exit: count,
+ * p50, p95, p99 and max. Buckets are exact below 16us, then 16 per power
+ * of two, so a percentile is off by at most 1/16th.
+ */
+
+int editorLatencyBucket(uint64_t us) {
+    int e = 0;
+    if (us < 16) return us;
+    while (us >> (e + 1)) e++;  // us is in [2^e, 2^(e+1))
+    if (e > 40) return LATENCY_BUCKETS - 1;
+    return 16 + (e - 4) * 16 + (int)((us >> (e - 4)) & 15);
+}
+
+/*
+ * Smallest value that falls in bucket b.
+ */
+uint64_t editorLatencyBucketStart(int b) {
+    int e;
+    if (b < 16) return b;
+    e = (b - 16) / 16 + 4;
+    return ((uint64_t)1 << e) + ((uint64_t)((b - 16) % 16) << (e - 4));
+}
+
+/*
+ * A key just came in. Only the oldest key not yet on screen is timed.
+ */
+void editorLatencyKey() {
+    if (E.latency.on && E.latency.keyat == 0) E.latency.keyat = editorTraceNow();
+}
+
+/*
+ * A frame was just written: whatever key was pending is now on screen.
+ */
+void editorLatencyFrame() {
+    uint64_t us;
+
+    if (E.latency.keyat == 0) return;
+    editorTraceSpan("key to photon", E.latency.keyat);
+    us = (editorTraceNow() - E.latency.keyat) / 1000;
+    E.latency.keyat = 0;
+    E.latency.buckets[editorLatencyBucket(us)]++;
+    E.latency.count++;
+    if (us > E.latency.max) E.latency.max = us;
+}
+
+uint64_t editorLatencyPercentile(int p) {
+    unsigned long long want = (E.latency.count * p + 99) / 100, seen = 0;
+    int b;
+
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += E.latency.buckets[b];
+        if (seen >= want) return editorLatencyBucketStart(b);
+    }
+    return E.latency.max;
+}
+
+/*
+ * Registered with atexit() before raw mode, so it runs after the terminal is back to normal.
+ */
+void editorLatencyReport() {
+    if (!E.latency.on || E.latency.count == 0) return;
+    fprintf(stderr, "keystroke to photon over %llu keys: p50 %lluus  p95 %lluus  p99 %lluus  max %lluus\n",
+            E.latency.count, (unsigned long long)editorLatencyPercentile(50),
+            (unsigned long long)editorLatencyPercentile(95), (unsigned long long)editorLatencyPercentile(99),
+            (unsigned long long)E.latency.max);
+}
+
+/*** terminal ***/
+
+/*
+ * die() prints an error message and exits.
+ * It uses perror() to describe the most recent system call failure.
+ */
+void die(const char *s) {
+    // Clear screen on exit
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+
+    perror(s);
+    exit(1);
+}
+
+/*
+ * disableRawMode() restores the terminal settings to their original state.
+ * This gets registered with atexit() so it's called when the program exits,
+ * even if it crashes or exits early.
+ */
+void disableRawMode() {
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) die("tcsetattr");
+}
+
+/*
+ * enableRawMode() puts the terminal into "raw mode", turning off features like
+ * line buffering, echo, signal generation, etc. This is needed for real-time
+ * key input handling in a text editor.
+ */
+void enableRawMode() {
+    // Get the current terminal attributes and store them for later restoration
+    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcgetattr");
+
+    // Ensure disableRawMode() is called on program exit
+    atexit(disableRawMode);
+
+    struct termios raw = E.orig_termios;
+
+    /*
+     * Input flags (c_iflag):
+     *  - BRKINT: disable Ctrl-C generating a SIGINT when break condition is detected
+     *  - ICRNL: disable conversion of CR to NL (allows raw handling of Enter)
+     *  - INPCK and ISTRIP: legacy/rare input features, we disable them for raw
+     *  - IXON: disable software flow control (Ctrl-S, Ctrl-Q)
+     */
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+
+    /*
+     * Output flags (c_oflag):
+     *  - OPOST: disable all post-processing of output (e.g., converting `\n` to `\r\n`)
+     */
+    raw.c_oflag &= ~(OPOST);
+
+    /*
+     * Control flags (c_cflag):
+     *  - CS8: set character size to 8 bits per byte (standard)
+     */
+    raw.c_cflag |= (CS8);
+
+    /*
+     * Local flags (c_lflag):
+     *  - ECHO: disable echoing input characters to the screen
+     *  - ICANON: disable canonical mode (so input is read byte-by-byte)
+     *  - IEXTEN: disable Ctrl-V and other extended input processing
+     *  - ISIG: disable signal generation from keys like Ctrl-C (SIGINT), Ctrl-Z (SIGTSTP)
+     */
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+
+    /*
+     * Control characters (c_cc):
+     *  - VMIN = 0: read returns as soon as there's any input (non-blocking read)
+     *  - VTIME = 1: set a 100ms timeout for read()
+     *    This allows read to block briefly and return if no input is given,
+     *    so we don't burn CPU in a tight polling loop.
+     */
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 1;
+
+    // Apply the modified attributes immediately
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+}
+
+/* Wait for one keypress and return it
+ * Escape sequences (arrows, Home/End, PageUp/PageDown, Del) come back as editorKey values
+ */
+int editorReadKey() {
+    int nread;
+    char c;
+    uint64_t start = editorTraceNow();
+    editorWaitKey();
+    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+        if (nread == -1 && errno != EAGAIN) die("read");
+    }
+    editorTraceSpan("wait for key", start);
+    editorLatencyKey();
+
+    if (c == '\x1b') {
+        char seq[3];  // grab value after escape sequence
+
+        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
+        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+
+        if (seq[0] == '[') {
+            if (seq[1] >= '0' && seq[1] <= '9') {
+                // <esc>[5~ style sequences
+                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                if (seq[2] == '~') {
+                    switch (seq[1]) {
+                        case '1':
+                        case '7':
+                            return HOME_KEY;
+                        case '3':
+                            return DEL_KEY;
+                        case '4':
+                        case '8':
+                            return END_KEY;
+                        case '5':
+                            return PAGE_UP;
+                        case '6':
+                            return PAGE_DOWN;
+                    }
+                }
+            } else {
+                switch (seq[1]) {
+                    case 'A':
+                        return ARROW_UP;
+                    case 'B':
+                        return ARROW_DOWN;
+                    case 'C':
+                        return ARROW_RIGHT;
+                    case 'D':
+                        return ARROW_LEFT;
+                    case 'H':
+                        return HOME_KEY;
+                    case 'F':
+                        return END_KEY;
+                }
+            }
+        }
+
+        return '\x1b';
+    } else {
+        return (unsigned char)c;
+    }
+}
+
+int getCursorPosition(int *rows, int *cols) {
+    char buf[32];
+    unsigned int i = 0;
+
+    if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
+
+    while (i < sizeof(buf) - 1) {
+        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (buf[i] == 'R') break;
+        i++;
+    }
+    buf[i] = '\0';
+
+    if (buf[0] != '\x1b' || buf[1] != '[') return -1;
+    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
+
+    return -1;
+}
+/*
+ * Get window size col and row
+ */
+int getWindowSize(int *rows, int *cols) {
+    struct winsize ws;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
+            return -1;  // https://vt100.net/docs/vt100-ug/chapter3.html#CUD
+        return getCursorPosition(rows, cols);
+    } else {
+        *cols = ws.ws_col;
+        *rows = ws.ws_row;
+        return 0;
+    }
+}
+
+/*** folding ***/
+
+/*
+ * Folds live in a treap ordered by position. A node stores where its fold
+ * is relative to the one before it (gap: lines from the previous fold's
+ * end, or from line 0, to its start) and how many lines it hides (len),
+ * and every subtree sums both. A fold's start, end and screen row are sums
+ * along the path to it, so going from a screen row to a file line and back
+ * is O(log n) however many folds there are. Inserting or deleting a row
+ * changes the gap or len of one fold, and everything after it moves along
+ * for free: an edit costs O(log n) too.
+ */
+
+int editorFoldNew(int gap, int len) {
+    struct foldNode *f;
+    int i;
+
+    if (E.folds.free) {
+        i = E.folds.free;
+        E.folds.free = E.folds.n[i].left;
+    } else {
+        if (E.folds.used == 0) E.folds.used = 1;  // node 0 is the empty tree
+        if (E.folds.used >= E.folds.cap) {
+            E.folds.cap = E.folds.cap ? E.folds.cap * 2 : 16;
+            E.folds.n = realloc(E.folds.n, sizeof(struct foldNode) * E.folds.cap);
+            if (E.folds.n == NULL) die("realloc");
+            memset(&E.folds.n[0], 0, sizeof(struct foldNode));
+        }
+        i = E.folds.used++;
+    }
+    f = &E.folds.n[i];
+    f->gap = gap;
+    f->len = len;
+    f->span = gap + len;
+    f->hid = len;
+    f->prio = rand();
+    f->left = f->right = 0;
+    E.folds.len++;
+    return i;
+}
+
+void editorFoldFree(int t) {
+    if (t == 0) return;
+    editorFoldFree(E.folds.n[t].left);
+    editorFoldFree(E.folds.n[t].right);
+    E.folds.n[t].left = E.folds.free;
+    E.folds.free = t;
+    E.folds.len--;
+}
+
+void editorFoldPull(int t) {
+    struct foldNode *f = &E.folds.n[t], *l = &E.folds.n[f->left], *r = &E.folds.n[f->right];
+    f->span = l->span + f->gap + f->len + r->span;
+    f->hid = l->hid + f->len + r->hid;
+}
+
+/*
+ * Split tree t, which starts after line base, into the folds starting
+ * before line (*a) and the others (*b).
+ */
+void editorFoldSplit(int t, int base, int line, int *a, int *b) {
+    struct foldNode *f;
+
+    if (t == 0) {
+        *a = *b = 0;
+        return;
+    }
+    f = &E.folds.n[t];
+    if (base + E.folds.n[f->left].span + f->gap < line) {
+        editorFoldSplit(f->right, base + E.folds.n[f->left].span + f->gap + f->len, line, &f->right, b);
+        *a = t;
+    } else {
+        editorFoldSplit(f->left, base, line, a, &f->left);
+        *b = t;
+    }
+    editorFoldPull(t);
+}
+
+int editorFoldMerge(int a, int b) {
+    if (a == 0 || b == 0) return a ? a : b;
+    if (E.folds.n[a].prio > E.folds.n[b].prio) {
+        E.folds.n[a].right = editorFoldMerge(E.folds.n[a].right, b);
+        editorFoldPull(a);
+        return a;
+    }
+    E.folds.n[b].left = editorFoldMerge(a, E.folds.n[b].left);
+    editorFoldPull(b);
+    return b;
+}
+
+/*
+ * Add d to the gap of the first fold of t: everything in t moves by d.
+ */
+void editorFoldShift(int t, int d) {
+    if (t == 0) return;
+    if (E.folds.n[t].left)
+        editorFoldShift(E.folds.n[t].left, d);
+    else
+        E.folds.n[t].gap += d;
+    editorFoldPull(t);
+}
+
+/*
+ * Add d to the len of the last fold of t.
+ */
+void editorFoldGrowLast(int t, int d) {
+    if (E.folds.n[t].right)
+        editorFoldGrowLast(E.folds.n[t].right, d);
+    else
+        E.folds.n[t].len += d;
+    editorFoldPull(t);
+}
+
+/*
+ * Split the last fold off tree a (folds starting at 0) into *m. Its start
+ * is span(a) - len of that fold, since the last fold ends where a does.
+ */
+void editorFoldSplitLast(int *a, int *m) {
+    int t = *a, last;
+    for (last = t; E.folds.n[last].right; last = E.folds.n[last].right);
+    editorFoldSplit(t, 0, E.folds.n[t].span - E.folds.n[last].len, a, m);
+}
+
+/*
+ * Lines hidden by all folds.
+ */
+int editorFoldsHidden() { return E.folds.n ? E.folds.n[E.folds.root].hid : 0; }
+
+/*
+ * The last fold starting before line: returns its start (-1 if there is
+ * none), sets *end and *hidden, the lines hidden by the folds before it.
+ */
+int editorFoldBefore(int line, int *end, int *hidden) {
+    int t = E.folds.root, base = 0, hid = 0, found = -1;
+
+    while (t) {
+        struct foldNode *f = &E.folds.n[t], *l = &E.folds.n[f->left];
+        int start = base + l->span + f->gap;
+        if (start < line) {
+            found = start;
+            *end = start + f->len;
+            *hidden = hid + l->hid;
+            base = *end;
+            hid += l->hid + f->len;
+            t = f->right;
+        } else {
+            t = f->left;
+        }
+    }
+    return found;
+}
+
+/*
+ * End of the fold whose first (still visible) line is line, or -1.
+ */
+int editorFoldAt(int line) {
+    int end, hidden;
+    return editorFoldBefore(line + 1, &end, &hidden) == line ? end : -1;
+}
+
+int editorFoldRowToLine(int vrow) {
+    // lines hidden by the folds whose first line is above vrow on screen
+    int t = E.folds.root, shown = 0, hid = 0;
+
+    while (t) {
+        struct foldNode *f = &E.folds.n[t], *l = &E.folds.n[f->left];
+        int row = shown + (l->span - l->hid) + f->gap;
+        if (row < vrow) {
+            shown = row;
+            hid += l->hid + f->len;
+            t = f->right;
+        } else {
+            t = f->left;
+        }
+    }
+    return vrow + hid;
+}
+
+/*
+ * Screen row of line, or of the fold hiding it.
+ */
+int editorFoldLineToRow(int line) {
+    int end, hidden, start = editorFoldBefore(line, &end, &hidden);
+    if (start == -1) return line;
+    if (line <= end) return start - hidden;
+    return line - hidden - (end - start);
+}
+
+/*
+ * Open the fold starting at line.
+ */
+void editorFoldRemove(int line) {
+    int a, m, b;
+    editorFoldSplit(E.folds.root, 0, line, &a, &b);
+    editorFoldSplit(b, E.folds.n[a].span, line + 1, &m, &b);
+    editorFoldShift(b, E.folds.n[m].span);
+    editorFoldFree(m);
+    E.folds.root = editorFoldMerge(a, b);
+}
+
+/*
+ * Hide lines start+1..end. Folds inside that range are swallowed by it.
+ */
+void editorFoldAdd(int start, int end) {
+    int f = editorFoldNew(0, end - start), a, m, b, base;  // may move the nodes, so first
+
+    editorFoldSplit(E.folds.root, 0, start, &a, &b);
+    base = E.folds.n[a].span;
+    editorFoldSplit(b, base, end + 1, &m, &b);
+    editorFoldShift(b, base + E.folds.n[m].span - end);
+    editorFoldFree(m);
+    E.folds.n[f].gap = start - base;
+    editorFoldPull(f);
+    E.folds.root = editorFoldMerge(editorFoldMerge(a, f), b);
+}
+
+int editorRowIndent(erow *row) {
+    int i = 0;
+    while (i < row->size && (row->chars[i] == ' ' || row->chars[i] == '\t')) i++;
+    return i == row->size ? -1 : i;  // -1 for blank lines
+}
+
+/*
+ * Fold the lines below line that are indented deeper than it (blank lines
+ * in between included, trailing ones not), or open the fold starting there.
+ */
+void editorFoldToggle(int line) {
+    int indent, end, j;
+
+    if (editorFoldAt(line) != -1) {
+        editorFoldRemove(line);
+        return;
+    }
+
+    indent = editorRowIndent(&E.row[line]);
+    if (indent == -1) return;
+    end = line;
+    for (j = line + 1; j < E.numrows; j++) {
+        int in = editorRowIndent(&E.row[j]);
+        if (in == -1) continue;
+        if (in <= indent) break;
+        end = j;
+    }
+    if (end > line) editorFoldAdd(line, end);
+}
+
+/*
+ * Keep the folds on the same lines when the file changes under them:
+ * a row inserted inside a fold stays hidden, deleting the first line of a
+ * fold opens it. Only the fold at the edit and the gap after it change.
+ */
+void editorFoldRowInserted(int at) {
+    int a, b;
+    if (E.folds.len == 0) return;
+    editorFoldSplit(E.folds.root, 0, at, &a, &b);
+    if (a && E.folds.n[a].span >= at)
+        editorFoldGrowLast(a, 1);  // inside the fold before it
+    else
+        editorFoldShift(b, 1);
+    E.folds.root = editorFoldMerge(a, b);
+}
+
+void editorFoldRowDeleted(int at) {
+    int a, m = 0, b, last, shift = -1;
+    if (E.folds.len == 0) return;
+    editorFoldSplit(E.folds.root, 0, at + 1, &a, &b);
+    if (a && at <= E.folds.n[a].span) {  // in the last fold starting at or before at
+        for (last = a; E.folds.n[last].right; last = E.folds.n[last].right);
+        if (at == E.folds.n[a].span - E.folds.n[last].len) {
+            editorFoldSplitLast(&a, &m);
+        } else {
+            editorFoldGrowLast(a, -1);
+            shift = 0;  // the fold ends a line earlier, like everything after it
+            if (E.folds.n[last].len == 0) editorFoldSplitLast(&a, &m);
+        }
+    }
+    editorFoldShift(b, E.folds.n[m].span + shift);
+    editorFoldFree(m);
+    E.folds.root = editorFoldMerge(a, b);
+}
+
+/*
+ * Lines start..end were replaced by n others: the folds touching them are
+ * gone, the ones below move with the text.
+ */
+void editorFoldLinesReplaced(int start, int end, int n) {
+    int a, m, b, last;
+    if (E.folds.len == 0) return;
+    editorFoldSplit(E.folds.root, 0, end + 1, &a, &b);
+    editorFoldSplit(a, 0, start, &a, &m);
+    if (a && E.folds.n[a].span >= start) {  // the fold before reaches into the range
+        editorFoldSplitLast(&a, &last);
+        m = editorFoldMerge(last, m);
+    }
+    editorFoldShift(b, E.folds.n[m].span + n - (end - start + 1));
+    editorFoldFree(m);
+    E.folds.root = editorFoldMerge(a, b);
+}
+
+/*** filter view ***/
+
+/*
+ * Number of rows the cursor can move over: the view's lines while a filter is
+ * active, the lines not hidden by a fold otherwise.
+ */
+int editorVisibleRows() { return E.view.active ? E.view.len : E.numrows - editorFoldsHidden(); }
+
+/*
+ * Translate a visible row (E.cy, E.rowoff + y) into a line of the file.
+ */
+int editorRowToLine(int vrow) {
+    if (E.view.active) return E.view.lines[vrow];
+    return E.folds.len ? editorFoldRowToLine(vrow) : vrow;
+}
+
+/*
+ * Visible row of a file line: its index in the view (-1 if the filter hides
+ * it), or its screen row once any fold hiding it has been opened.
+ */
+int editorLineToRow(int line) {
+    int start, end, hidden;
+    if (E.view.active) {
+        int lo = 0, hi = E.view.len - 1;
+        while (lo <= hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (E.view.lines[mid] == line) return mid;
+            if (E.view.lines[mid] < line)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+        return -1;
+    }
+    start = editorFoldBefore(line, &end, &hidden);
+    if (start != -1 && line <= end) editorFoldRemove(start);
+    return editorFoldLineToRow(line);
+}
+
+/*
+ * Put the cursor on line of the buffer, opening folds as needed. With no
+ * lines left (a range delete took them all) it goes back to the top, so
+ * the next keystroke starts a new first line instead of using a stale row.
+ */
+void editorGotoLine(int line, int col) {
+    int row;
+    if (E.numrows == 0) {
+        E.cx = E.cy = E.rowoff = 0;
+        return;
+    }
+    if (line < 0 || line >= E.numrows || (row = editorLineToRow(line)) == -1) return;
+    E.cy = row;
+    E.cx = col < E.row[line].size ? col : E.row[line].size;
+}
+
+void editorViewAppend(int line) {
+    if (E.view.len == E.view.cap) {
+        E.view.cap = E.view.cap ? E.view.cap * 2 : 1024;
+        E.view.lines = realloc(E.view.lines, sizeof(int) * E.view.cap);
+        if (E.view.lines == NULL) die("realloc");
+    }
+    E.view.lines[E.view.len++] = line;
+}
+
+/*
+ * Insert a line into the view at visible position at (used when Enter splits
+ * a line inside the view, so the new half stays visible).
+ */
+void editorViewInsert(int at, int line) {
+    editorViewAppend(line);
+    memmove(&E.view.lines[at + 1], &E.view.lines[at], sizeof(int) * (E.view.len - at - 1));
+    E.view.lines[at] = line;
+}
+
+/*
+ * A row was inserted into the file at line at: everything from there moves down one.
+ */
+void editorViewRowInserted(int at) {
+    int i;
+    if (!E.view.active) return;
+    for (i = 0; i < E.view.len; i++)
+        if (E.view.lines[i] >= at) E.view.lines[i]++;
+}
+
+/*
+ * Line at was deleted from the file: drop it from the view and move everything after it up one.
+ */
+void editorViewRowDeleted(int at) {
+    int i, j = 0;
+    if (!E.view.active) return;
+    for (i = 0; i < E.view.len; i++) {
+        if (E.view.lines[i] == at) continue;
+        E.view.lines[j++] = E.view.lines[i] > at ? E.view.lines[i] - 1 : E.view.lines[i];
+    }
+    E.view.len = j;
+}
+
+/*
+ * Leave the filtered view, keeping the cursor on the same line of the file.
+ */
+void editorViewClose() {
+    if (!E.view.active) return;
+    E.cy = E.cy < E.view.len ? editorFoldLineToRow(E.view.lines[E.cy]) : 0;
+    E.rowoff = 0;
+    E.view.active = 0;
+    E.view.len = 0;
+    free(E.view.pattern);
+    E.view.pattern = NULL;
+}
+
+/*
+ * Build the index of lines containing pattern. The scan goes FILTER_BATCH
+ * lines at a time and refreshes the screen in between, so the first matches
+ * are on screen long before the end of a huge file has been searched.
+ */
+void editorViewBuild(const char *pattern) {
+    size_t patlen = strlen(pattern);
+    int start, i;
+
+    editorViewClose();
+    E.view.active = 1;
+    E.view.pattern = strdup(pattern);
+    E.cx = 0;
+    E.cy = 0;
+
+    for (start = 0; start < E.numrows; start += FILTER_BATCH) {
+        int end = start + FILTER_BATCH < E.numrows ? start + FILTER_BATCH : E.numrows;
+        for (i = start; i < end; i++) {
+            if (memmem(E.row[i].chars, E.row[i].size, pattern, patlen)) editorViewAppend(i);
+        }
+        editorRefreshScreen();
+    }
+}
+
+/*
+ * Ask for a pattern and switch to a view of the matching lines.
+ * An empty pattern goes back to the whole file. Not while a command runs:
+ * its output would replace lines under the view.
+ */
+void editorFilter() {
+    char *pattern;
+
+    if (E.pipe.pid > 0) {
+        editorSetStatusMessage("Wait for the command to finish");
+        return;
+    }
+    pattern = editorPrompt("Filter: %s", NULL);
+    if (pattern == NULL) return;
+    if (pattern[0] == '\0')
+        editorViewClose();
+    else
+        editorViewBuild(pattern);
+    free(pattern);
+}
+
+/*** bracket matching ***/
+
+/*
+ * Bracket matching keeps a segment tree over chunks of about BRACKET_CHUNK rows.
+ * For each kind of bracket a node stores the net nesting change over its
+ * rows (openers - closers) and the lowest point the running depth reaches
+ * (min prefix). That is enough to find the chunk where an unmatched opener
+ * gets closed, or an unmatched closer got opened, in O(log n) instead of
+ * scanning every line in between. Chunks grow, shrink, split and merge
+ * as rows come and go, so an edit only ever looks at the rows it touched.
+ */
+
+static const char *bracketOpen = "([{";
+static const char *bracketClose = ")]}";
+
+/*
+ * Mark which bytes of a row are code, as opposed to the inside of a string,
+ * a character literal or a comment. It only looks at the row itself, there
+ * is no highlighter state to say whether it starts inside a block comment.
+ * A ' only starts a literal when it closes right after ('x', '\n'), so
+ * apostrophes in prose don't swallow the rest of the line.
+ */
+void editorCodeMask(erow *row, char *mask) {
+    const char *s = row->chars;
+    int i = 0, n = row->size;
+    char quote = 0;
+    int block = 0;
+
+    while (i < n) {
+        char c = s[i];
+        mask[i] = 0;
+        if (block) {
+            if (c == '*' && i + 1 < n && s[i + 1] == '/') {
+                mask[++i] = 0;
+                block = 0;
+            }
+        } else if (quote) {
+            if (c == '\\' && i + 1 < n)
+                mask[++i] = 0;
+            else if (c == quote)
+                quote = 0;
+        } else if (c == '"') {
+            quote = c;
+        } else if (c == '\'' && ((i + 2 < n && s[i + 2] == '\'') || (i + 3 < n && s[i + 1] == '\\' && s[i + 3] == '\''))) {
+            quote = c;
+        } else if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+            memset(&mask[i], 0, n - i);
+            return;
+        } else if (c == '/' && i + 1 < n && s[i + 1] == '*') {
+            mask[++i] = 0;
+            block = 1;
+        } else {
+            mask[i] = 1;
+        }
+        i++;
+    }
+}
+
+/*
+ * editorCodeMask() of row into the bracket index's buffer.
+ */
+char *editorBracketMask(erow *row) {
+    if (row->size + 1 > E.brackets.maskcap) {
+        E.brackets.maskcap = row->size + 1 > E.brackets.maskcap * 2 ? row->size + 1 : E.brackets.maskcap * 2;
+        E.brackets.mask = realloc(E.brackets.mask, E.brackets.maskcap);
+        if (E.brackets.mask == NULL) die("realloc");
+    }
+    editorCodeMask(row, E.brackets.mask);
+    return E.brackets.mask;
+}
+
+/*
+ * Net depth change and min prefix depth of one row, for all three kinds of brackets.
+ */
+void editorBracketRowSummary(erow *row, int *net, int *min) {
+    char *mask = editorBracketMask(row);
+    int i, t;
+
+    for (t = 0; t < 3; t++) net[t] = min[t] = 0;
+    for (i = 0; i < row->size; i++) {
+        if (!mask[i]) continue;
+        for (t = 0; t < 3; t++) {
+            if (row->chars[i] == bracketOpen[t]) net[t]++;
+            if (row->chars[i] == bracketClose[t] && --net[t] < min[t]) min[t] = net[t];
+        }
+    }
+}
+
+int *editorBracketNode(int *arr, int t, int node) { return &arr[t * 2 * E.brackets.size + node]; }
+
+/*
+ * Recompute an inner node from its two children.
+ */
+void editorBracketPull(int node) {
+    int t;
+
+    E.brackets.rows[node] = E.brackets.rows[2 * node] + E.brackets.rows[2 * node + 1];
+    for (t = 0; t < 3; t++) {
+        int ln = *editorBracketNode(E.brackets.net, t, 2 * node);
+        int lm = *editorBracketNode(E.brackets.min, t, 2 * node);
+        int rn = *editorBracketNode(E.brackets.net, t, 2 * node + 1);
+        int rm = *editorBracketNode(E.brackets.min, t, 2 * node + 1);
+        *editorBracketNode(E.brackets.net, t, node) = ln + rn;
+        *editorBracketNode(E.brackets.min, t, node) = lm < ln + rm ? lm : ln + rm;
+    }
+}
+
+/*
+ * Copy chunk c into its leaf, without touching the nodes above.
+ */
+void editorBracketSetLeaf(int c) {
+    struct bracketChunk *ch = &E.brackets.chunks[c];
+    int node = E.brackets.size + c, t;
+
+    E.brackets.rows[node] = ch->rows;
+    for (t = 0; t < 3; t++) {
+        *editorBracketNode(E.brackets.net, t, node) = ch->net[t];
+        *editorBracketNode(E.brackets.min, t, node) = ch->min[t];
+    }
+}
+
+/*
+ * Chunk c changed: update its leaf and the nodes above it.
+ */
+void editorBracketLeafChanged(int c) {
+    int node;
+
+    editorBracketSetLeaf(c);
+    for (node = (E.brackets.size + c) / 2; node >= 1; node /= 2) editorBracketPull(node);
+}
+
+/*
+ * Lay the tree out again after chunks came or went. Only the chunk
+ * summaries are read, no row is looked at.
+ */
+void editorBracketTree() {
+    int size, c, node;
+
+    for (size = 1; size < E.brackets.len; size *= 2);
+    if (size != E.brackets.size || E.brackets.rows == NULL) {
+        E.brackets.size = size;
+        E.brackets.rows = realloc(E.brackets.rows, 2 * size * sizeof(int));
+        E.brackets.net = realloc(E.brackets.net, 3 * 2 * size * sizeof(int));
+        E.brackets.min = realloc(E.brackets.min, 3 * 2 * size * sizeof(int));
+        if (E.brackets.rows == NULL || E.brackets.net == NULL || E.brackets.min == NULL) die("realloc");
+    }
+    memset(E.brackets.rows, 0, 2 * size * sizeof(int));
+    memset(E.brackets.net, 0, 3 * 2 * size * sizeof(int));
+    memset(E.brackets.min, 0, 3 * 2 * size * sizeof(int));
+    for (c = 0; c < E.brackets.len; c++) editorBracketSetLeaf(c);
+    for (node = size - 1; node >= 1; node--) editorBracketPull(node);
+}
+
+/*
+ * Sum up the rows of chunk c, which starts at row start.
+ */
+void editorBracketSummarize(int c, int start) {
+    struct bracketChunk *ch = &E.brackets.chunks[c];
+    int net[3], min[3], t, r;
+
+    for (t = 0; t < 3; t++) ch->net[t] = ch->min[t] = 0;
+    for (r = start; r < start + ch->rows; r++) {
+        editorBracketRowSummary(&E.row[r], net, min);
+        for (t = 0; t < 3; t++) {
+            if (ch->net[t] + min[t] < ch->min[t]) ch->min[t] = ch->net[t] + min[t];
+            ch->net[t] += net[t];
+        }
+    }
+    ch->dirty = 0;
+}
+
+/*
+ * First row of chunk c: the rows of every left sibling on the way up.
+ */
+int editorBracketChunkStart(int c) {
+    int node, start = 0;
+
+    for (node = E.brackets.size + c; node > 1; node /= 2)
+        if (node & 1) start += E.brackets.rows[node - 1];
+    return start;
+}
+
+/*
+ * The chunk holding row line, which must be in the tree. *start is set to its first row.
+ */
+int editorBracketChunkOf(int line, int *start) {
+    int node = 1;
+
+    *start = 0;
+    while (node < E.brackets.size) {
+        node *= 2;
+        if (line >= *start + E.brackets.rows[node]) *start += E.brackets.rows[node++];
+    }
+    return node - E.brackets.size;
+}
+
+/*
+ * Make room for n dirty chunks without rows at c. The tree is not updated.
+ */
+void editorBracketInsertChunks(int c, int n) {
+    int i;
+
+    if (E.brackets.len + n > E.brackets.cap) {
+        while (E.brackets.len + n > E.brackets.cap) E.brackets.cap = E.brackets.cap ? E.brackets.cap * 2 : 64;
+        E.brackets.chunks = realloc(E.brackets.chunks, sizeof(struct bracketChunk) * E.brackets.cap);
+        if (E.brackets.chunks == NULL) die("realloc");
+    }
+    memmove(&E.brackets.chunks[c + n], &E.brackets.chunks[c], sizeof(struct bracketChunk) * (E.brackets.len - c));
+    for (i = c; i < c + n; i++) {
+        memset(&E.brackets.chunks[i], 0, sizeof(struct bracketChunk));
+        E.brackets.chunks[i].dirty = 1;
+        E.brackets.stale = 1;
+    }
+    E.brackets.len += n;
+}
+
+void editorBracketRemoveChunks(int c, int n) {
+    memmove(&E.brackets.chunks[c], &E.brackets.chunks[c + n], sizeof(struct bracketChunk) * (E.brackets.len - c - n));
+    E.brackets.len -= n;
+}
+
+/*
+ * Merge chunk c into chunk c - 1 if they fit in one. Returns whether it did.
+ */
+int editorBracketMerge(int c) {
+    if (c < 1 || c >= E.brackets.len) return 0;
+    if (E.brackets.chunks[c - 1].rows + E.brackets.chunks[c].rows > BRACKET_CHUNK) return 0;
+    E.brackets.chunks[c - 1].rows += E.brackets.chunks[c].rows;
+    E.brackets.chunks[c - 1].dirty = 1;
+    E.brackets.stale = 1;
+    editorBracketRemoveChunks(c, 1);
+    return 1;
+}
+
+/*
+ * Make a chunk start at row line and return it, or len if line is past
+ * the last row.
+ */
+int editorBracketSplitAt(int line) {
+    int start, c;
+
+    if (line >= E.brackets.rows[1]) return E.brackets.len;
+    c = editorBracketChunkOf(line, &start);
+    if (start == line) return c;
+    editorBracketInsertChunks(c + 1, 1);
+    E.brackets.chunks[c + 1].rows = start + E.brackets.chunks[c].rows - line;
+    E.brackets.chunks[c].rows = line - start;
+    E.brackets.chunks[c].dirty = 1;
+    editorBracketTree();
+    return c + 1;
+}
+
+/*
+ * Build the whole tree, on the first jump after a file was loaded.
+ */
+void editorBracketBuild() {
+    int c;
+
+    E.brackets.len = 0;
+    editorBracketInsertChunks(0, (E.numrows + BRACKET_CHUNK - 1) / BRACKET_CHUNK);
+    for (c = 0; c < E.brackets.len; c++) {
+        int left = E.numrows - c * BRACKET_CHUNK;
+        E.brackets.chunks[c].rows = left < BRACKET_CHUNK ? left : BRACKET_CHUNK;
+        editorBracketSummarize(c, c * BRACKET_CHUNK);
+    }
+    editorBracketTree();
+    E.brackets.stale = 0;
+    E.brackets.valid = 1;
+}
+
+/*
+ * Sum up the chunks left dirty by range edits, before a search.
+ */
+void editorBracketRefresh() {
+    int c, start;
+
+    for (c = start = 0; c < E.brackets.len; start += E.brackets.chunks[c++].rows)
+        if (E.brackets.chunks[c].dirty) editorBracketSummarize(c, start);
+    editorBracketTree();
+    E.brackets.stale = 0;
+}
+
+/*
+ * Rows start..end were replaced by n rows: their chunks are swapped for
+ * new dirty ones, left for the next jump to sum up. Slivers at the edges
+ * are merged with the new chunks.
+ */
+void editorBracketLinesReplaced(int start, int end, int n) {
+    int first, last, k, i;
+
+    if (!E.brackets.valid) return;
+    first = editorBracketSplitAt(start);
+    last = editorBracketSplitAt(end + 1);
+    editorBracketRemoveChunks(first, last - first);
+    k = (n + BRACKET_CHUNK - 1) / BRACKET_CHUNK;
+    editorBracketInsertChunks(first, k);
+    for (i = 0; i < k; i++) E.brackets.chunks[first + i].rows = i < k - 1 ? BRACKET_CHUNK : n - i * BRACKET_CHUNK;
+    editorBracketMerge(first + k);
+    editorBracketMerge(first);
+    editorBracketTree();
+}
+
+/*
+ * A row's text changed: refresh its chunk if the tree is built.
+ */
+void editorBracketRowChanged(int line) {
+    int start, c;
+
+    if (!E.brackets.valid) return;
+    c = editorBracketChunkOf(line, &start);
+    if (E.brackets.chunks[c].dirty) return;
+    editorBracketSummarize(c, start);
+    editorBracketLeafChanged(c);
+}
+
+/*
+ * Row line was inserted: it joins the chunk of the row it was inserted
+ * before (or the last one), which is split once it doubled.
+ */
+void editorBracketRowInserted(int line) {
+    int start, c;
+
+    if (!E.brackets.valid) return;
+    if (E.brackets.len == 0) {
+        editorBracketLinesReplaced(line, line - 1, 1);
+        return;
+    }
+    if (line < E.brackets.rows[1]) {
+        c = editorBracketChunkOf(line, &start);
+    } else {
+        c = E.brackets.len - 1;
+        start = editorBracketChunkStart(c);
+    }
+    E.brackets.chunks[c].rows++;
+    if (!E.brackets.chunks[c].dirty) editorBracketSummarize(c, start);
+    editorBracketLeafChanged(c);
+    if (E.brackets.chunks[c].rows > 2 * BRACKET_CHUNK) editorBracketSplitAt(start + E.brackets.chunks[c].rows / 2);
+}
+
+/*
+ * Row line was deleted: shrink its chunk, and merge it into a neighbour
+ * once it gets small.
+ */
+void editorBracketRowDeleted(int line) {
+    int start, c, merged;
+
+    if (!E.brackets.valid) return;
+    c = editorBracketChunkOf(line, &start);
+    if (--E.brackets.chunks[c].rows == 0) {
+        editorBracketRemoveChunks(c, 1);
+        editorBracketTree();
+        return;
+    }
+    if (E.brackets.chunks[c].rows < BRACKET_CHUNK / 4) {
+        merged = editorBracketMerge(c + 1);
+        merged += editorBracketMerge(c);
+        if (merged) {
+            editorBracketTree();
+            return;
+        }
+    }
+    if (!E.brackets.chunks[c].dirty) editorBracketSummarize(c, start);
+    editorBracketLeafChanged(c);
+}
+
+/*
+ * First chunk from chunk `from` on where depth (*acc before it) drops to 0.
+ * On return *acc is the depth at the start of the chunk found.
+ */
+int editorBracketFindForward(int t, int node, int nl, int nr, int from, int *acc) {
+    int mid, found;
+    if (nr <= from) return -1;
+    if (from <= nl && *acc + *editorBracketNode(E.brackets.min, t, node) > 0) {
+        *acc += *editorBracketNode(E.brackets.net, t, node);
+        return -1;
+    }
+    if (nr - nl == 1) return nl;
+    mid = nl + (nr - nl) / 2;
+    found = editorBracketFindForward(t, 2 * node, nl, mid, from, acc);
+    if (found != -1) return found;
+    return editorBracketFindForward(t, 2 * node + 1, mid, nr, from, acc);
+}
+
+/*
+ * Last chunk up to chunk `to` where, walking backwards, the count of
+ * unmatched closers (*acc) drops to 0. Walking a range backwards lowers
+ * it by at most net - min, the range's best suffix.
+ */
+int editorBracketFindBackward(int t, int node, int nl, int nr, int to, int *acc) {
+    int mid, found;
+    if (nl > to) return -1;
+    if (nr - 1 <= to) {
+        int net = *editorBracketNode(E.brackets.net, t, node);
+        if (*acc - (net - *editorBracketNode(E.brackets.min, t, node)) > 0) {
+            *acc -= net;
+            return -1;
+        }
+    }
+    if (nr - nl == 1) return nl;
+    mid = nl + (nr - nl) / 2;
+    found = editorBracketFindBackward(t, 2 * node + 1, mid, nr, to, acc);
+    if (found != -1) return found;
+    return editorBracketFindBackward(t, 2 * node, nl, mid, to, acc);
+}
+
+/*
+ * Scan one row for the bracket that brings depth to 0, starting at column
+ * from and going in direction dir (+1 for a match of an opener, -1 for a
+ * closer). Returns the column, or -1 with *depth updated.
+ */
+int editorBracketScanRow(int line, int t, int from, int dir, int *depth) {
+    erow *row = &E.row[line];
+    char *mask = editorBracketMask(row);
+    int i, found = -1;
+
+    for (i = from; i >= 0 && i < row->size; i += dir) {
+        if (!mask[i]) continue;
+        if (row->chars[i] == (dir > 0 ? bracketOpen : bracketClose)[t]) (*depth)++;
+        if (row->chars[i] == (dir > 0 ? bracketClose : bracketOpen)[t] && --(*depth) == 0) {
+            found = i;
+            break;
+        }
+    }
+    return found;
+}
+
+/*
+ * Find the row where a bracket left unmatched on row line (depth still
+ * open) gets its match: rows up to the chunk boundary one by one, then the
+ * tree for the chunk, then the rows of that chunk. *depth is left at the
+ * depth going into the row found.
+ */
+int editorBracketFindRow(int line, int t, int dir, int *depth) {
+    int r, acc, chunk, start, end, net[3], min[3];
+
+    if (!E.brackets.valid)
+        editorBracketBuild();
+    else if (E.brackets.stale)
+        editorBracketRefresh();
+    chunk = editorBracketChunkOf(line, &start);
+
+    if (dir > 0) {
+        end = start + E.brackets.chunks[chunk].rows;
+        for (r = line + 1; r < end; r++) {
+            editorBracketRowSummary(&E.row[r], net, min);
+            if (*depth + min[t] <= 0) return r;
+            *depth += net[t];
+        }
+        if (r >= E.numrows) return -1;
+        acc = *depth;
+        chunk = editorBracketFindForward(t, 1, 0, E.brackets.size, chunk + 1, &acc);
+        if (chunk == -1) return -1;
+        *depth = acc;
+        for (r = editorBracketChunkStart(chunk); r < E.numrows; r++) {
+            editorBracketRowSummary(&E.row[r], net, min);
+            if (*depth + min[t] <= 0) return r;
+            *depth += net[t];
+        }
+        return -1;
+    }
+
+    for (r = line - 1; r >= start; r--) {
+        editorBracketRowSummary(&E.row[r], net, min);
+        if (*depth - (net[t] - min[t]) <= 0) return r;
+        *depth -= net[t];
+    }
+    if (r < 0) return -1;
+    acc = *depth;
+    chunk = editorBracketFindBackward(t, 1, 0, E.brackets.size, chunk - 1, &acc);
+    if (chunk == -1) return -1;
+    *depth = acc;
+    start = editorBracketChunkStart(chunk);
+    for (r = start + E.brackets.chunks[chunk].rows - 1; r >= start; r--) {
+        editorBracketRowSummary(&E.row[r], net, min);
+        if (*depth - (net[t] - min[t]) <= 0) return r;
+        *depth -= net[t];
+    }
+    return -1;
+}
+
+/*
+ * Find the bracket matching the one at line/col. Returns 0 and sets
+ * *mline and *mcol, or -1 if there is no bracket there or it is unmatched.
+ */
+int editorBracketMatch(int line, int col, int *mline, int *mcol) {
+    erow *row = &E.row[line];
+    const char *p;
+    int t, dir, depth = 1, found;
+
+    if (col >= row->size) return -1;
+    if (!editorBracketMask(row)[col] || row->chars[col] == '\0') return -1;
+
+    if ((p = strchr(bracketOpen, row->chars[col])) != NULL) {
+        t = p - bracketOpen;
+        dir = 1;
+    } else if ((p = strchr(bracketClose, row->chars[col])) != NULL) {
+        t = p - bracketClose;
+        dir = -1;
+    } else {
+        return -1;
+    }
+
+    found = editorBracketScanRow(line, t, col + dir, dir, &depth);
+    if (found == -1) {
+        line = editorBracketFindRow(line, t, dir, &depth);
+        if (line == -1) return -1;
+        found = editorBracketScanRow(line, t, dir > 0 ? 0 : E.row[line].size - 1, dir, &depth);
+        if (found == -1) return -1;
+    }
+    *mline = line;
+    *mcol = found;
+    return 0;
+}
+
+/*
+ * '%': jump to the bracket matching the one under the cursor.
+ */
+void editorBracketJump() {
+    int line, col, row;
+
+    if (E.cy >= editorVisibleRows()) return;
+    if (editorBracketMatch(editorRowToLine(E.cy), E.cx, &line, &col) == -1) return;
+    if ((row = editorLineToRow(line)) == -1) return;
+    E.cy = row;
+    E.cx = col;
+}
+
+/*** minimap ***/
+
+/*
+ * M shows the whole file as a column of braille on the right, one dot row
+ * per group of lines, dots lit up to the length of the longest line in
+ * the group (MINIMAP_DOT bytes per dot), the part on screen brighter.
+ * Lines are kept in chunks of about MINIMAP_CHUNK rows that know their
+ * longest line, under a tree of row counts and maximums. A dot row is then
+ * an O(log n) query plus the lengths of at most two partial chunks, and
+ * drawing costs the same for any file size. Like the bracket index, chunks
+ * grow, shrink, split and merge as rows come and go, and the whole tree is
+ * only built on the first draw after a file is loaded.
+ */
+
+void editorMinimapPull(int node) {
+    int l = E.minimap.max[2 * node], r = E.minimap.max[2 * node + 1];
+
+    E.minimap.rows[node] = E.minimap.rows[2 * node] + E.minimap.rows[2 * node + 1];
+    E.minimap.max[node] = l > r ? l : r;
+}
+
+void editorMinimapLeafChanged(int c) {
+    int node = E.minimap.size + c;
+
+    E.minimap.rows[node] = E.minimap.chunks[c].rows;
+    E.minimap.max[node] = E.minimap.chunks[c].max;
+    for (node /= 2; node >= 1; node /= 2) editorMinimapPull(node);
+}
+
+/*
+ * Lay the tree out again after chunks came or went.
+ */
+void editorMinimapTree() {
+    int size, c, node;
+
+    for (size = 1; size < E.minimap.len; size *= 2);
+    if (size != E.minimap.size || E.minimap.rows == NULL) {
+        E.minimap.size = size;
+        E.minimap.rows = realloc(E.minimap.rows, 2 * size * sizeof(int));
+        E.minimap.max = realloc(E.minimap.max, 2 * size * sizeof(int));
+        if (E.minimap.rows == NULL || E.minimap.max == NULL) die("realloc");
+    }
+    memset(E.minimap.rows, 0, 2 * size * sizeof(int));
+    memset(E.minimap.max, 0, 2 * size * sizeof(int));
+    for (c = 0; c < E.minimap.len; c++) {
+        E.minimap.rows[size + c] = E.minimap.chunks[c].rows;
+        E.minimap.max[size + c] = E.minimap.chunks[c].max;
+    }
+    for (node = size - 1; node >= 1; node--) editorMinimapPull(node);
+}
+
+/*
+ * Longest line of chunk c, which starts at row start.
+ */
+void editorMinimapSummarize(int c, int start) {
+    struct minimapChunk *ch = &E.minimap.chunks[c];
+    int r;
+
+    ch->max = 0;
+    for (r = start; r < start + ch->rows; r++)
+        if (E.row[r].size > ch->max) ch->max = E.row[r].size;
+    ch->dirty = 0;
+}
+
+int editorMinimapChunkStart(int c) {
+    int node, start = 0;
+
+    for (node = E.minimap.size + c; node > 1; node /= 2)
+        if (node & 1) start += E.minimap.rows[node - 1];
+    return start;
+}
+
+/*
+ * The chunk holding row line, which must be in the tree. *start is set to its first row.
+ */
+int editorMinimapChunkOf(int line, int *start) {
+    int node = 1;
+
+    *start = 0;
+    while (node < E.minimap.size) {
+        node *= 2;
+        if (line >= *start + E.minimap.rows[node]) *start += E.minimap.rows[node++];
+    }
+    return node - E.minimap.size;
+}
+
+/*
+ * Make room for n dirty chunks without rows at c. The tree is not updated.
+ */
+void editorMinimapInsertChunks(int c, int n) {
+    int i;
+
+    if (E.minimap.len + n > E.minimap.cap) {
+        while (E.minimap.len + n > E.minimap.cap) E.minimap.cap = E.minimap.cap ? E.minimap.cap * 2 : 64;
+        E.minimap.chunks = realloc(E.minimap.chunks, sizeof(struct minimapChunk) * E.minimap.cap);
+        if (E.minimap.chunks == NULL) die("realloc");
+    }
+    memmove(&E.minimap.chunks[c + n], &E.minimap.chunks[c], sizeof(struct minimapChunk) * (E.minimap.len - c));
+    for (i = c; i < c + n; i++) {
+        E.minimap.chunks[i].rows = E.minimap.chunks[i].max = 0;
+        E.minimap.chunks[i].dirty = 1;
+    }
+    E.minimap.len += n;
+}
+
+void editorMinimapRemoveChunks(int c, int n) {
+    memmove(&E.minimap.chunks[c], &E.minimap.chunks[c + n], sizeof(struct minimapChunk) * (E.minimap.len - c - n));
+    E.minimap.len -= n;
+}
+
+/*
+ * Merge chunk c into chunk c - 1 if they fit in one. Returns whether it did.
+ */
+int editorMinimapMerge(int c) {
+    struct minimapChunk *a, *b;
+
+    if (c < 1 || c >= E.minimap.len) return 0;
+    a = &E.minimap.chunks[c - 1];
+    b = &E.minimap.chunks[c];
+    if (a->rows + b->rows > MINIMAP_CHUNK) return 0;
+    a->rows += b->rows;
+    a->max = a->max > b->max ? a->max : b->max;
+    a->dirty |= b->dirty;
+    editorMinimapRemoveChunks(c, 1);
+    return 1;
+}
+
+/*
+ * Make a chunk start at row line and return it, or len if line is past
+ * the last row. Both halves are left dirty: the rows may already have
+ * moved under them.
+ */
+int editorMinimapSplitAt(int line) {
+    int start, c;
+
+    if (line >= E.minimap.rows[1]) return E.minimap.len;
+    c = editorMinimapChunkOf(line, &start);
+    if (start == line) return c;
+    editorMinimapInsertChunks(c + 1, 1);
+    E.minimap.chunks[c + 1].rows = start + E.minimap.chunks[c].rows - line;
+    E.minimap.chunks[c].rows = line - start;
+    E.minimap.chunks[c].dirty = 1;
+    editorMinimapTree();
+    return c + 1;
+}
+
+/*
+ * Measure the dirty chunks against the rows as they are now and lay the
+ * tree out again. Only row sizes are read.
+ */
+void editorMinimapRefresh() {
+    int c, start;
+
+    for (c = start = 0; c < E.minimap.len; start += E.minimap.chunks[c++].rows)
+        if (E.minimap.chunks[c].dirty) editorMinimapSummarize(c, start);
+    editorMinimapTree();
+}
+
+void editorMinimapBuild() {
+    int c;
+
+    E.minimap.len = 0;
+    editorMinimapInsertChunks(0, (E.numrows + MINIMAP_CHUNK - 1) / MINIMAP_CHUNK);
+    for (c = 0; c < E.minimap.len; c++) {
+        int left = E.numrows - c * MINIMAP_CHUNK;
+        E.minimap.chunks[c].rows = left < MINIMAP_CHUNK ? left : MINIMAP_CHUNK;
+    }
+    editorMinimapRefresh();
+    E.minimap.valid = 1;
+}
+
+/*
+ * Rows start..end were replaced by n rows: swap their chunks for new ones.
+ */
+void editorMinimapLinesReplaced(int start, int end, int n) {
+    int first, last, k, i;
+
+    if (!E.minimap.valid) return;
+    first = editorMinimapSplitAt(start);
+    last = editorMinimapSplitAt(end + 1);
+    editorMinimapRemoveChunks(first, last - first);
+    k = (n + MINIMAP_CHUNK - 1) / MINIMAP_CHUNK;
+    editorMinimapInsertChunks(first, k);
+    for (i = 0; i < k; i++) E.minimap.chunks[first + i].rows = i < k - 1 ? MINIMAP_CHUNK : n - i * MINIMAP_CHUNK;
+    editorMinimapMerge(first + k);
+    editorMinimapMerge(first);
+    editorMinimapRefresh();
+}
+
+void editorMinimapRowChanged(int line) {
+    int start, c;
+
+    if (!E.minimap.valid) return;
+    c = editorMinimapChunkOf(line, &start);
+    editorMinimapSummarize(c, start);
+    editorMinimapLeafChanged(c);
+}
+
+/*
+ * Row line was inserted: it joins the chunk of the row it was inserted
+ * before (or the last one), which is split once it doubled.
+ */
+void editorMinimapRowInserted(int line) {
+    int start, c;
+
+    if (!E.minimap.valid) return;
+    if (E.minimap.len == 0) {
+        editorMinimapLinesReplaced(line, line - 1, 1);
+        return;
+    }
+    if (line < E.minimap.rows[1]) {
+        c = editorMinimapChunkOf(line, &start);
+    } else {
+        c = E.minimap.len - 1;
+        start = editorMinimapChunkStart(c);
+    }
+    E.minimap.chunks[c].rows++;
+    editorMinimapSummarize(c, start);
+    editorMinimapLeafChanged(c);
+    if (E.minimap.chunks[c].rows > 2 * MINIMAP_CHUNK) {
+        editorMinimapSplitAt(start + E.minimap.chunks[c].rows / 2);
+        editorMinimapRefresh();
+    }
+}
+
+/*
+ * Row line was deleted: shrink its chunk, and merge it into a neighbour
+ * once it gets small.
+ */
+void editorMinimapRowDeleted(int line) {
+    int start, c, merged;
+
+    if (!E.minimap.valid) return;
+    c = editorMinimapChunkOf(line, &start);
+    if (--E.minimap.chunks[c].rows == 0) {
+        editorMinimapRemoveChunks(c, 1);
+        editorMinimapTree();
+        return;
+    }
+    editorMinimapSummarize(c, start);
+    if (E.minimap.chunks[c].rows < MINIMAP_CHUNK / 4) {
+        merged = editorMinimapMerge(c + 1);
+        merged += editorMinimapMerge(c);
+        if (merged) {
+            editorMinimapTree();
+            return;
+        }
+    }
+    editorMinimapLeafChanged(c);
+}
+
+/*
+ * Length of the longest line in lo..hi-1: the rows of the chunks at both
+ * ends one by one, the chunks in between through the tree.
+ */
+int editorMinimapQuery(int lo, int hi) {
+    int best = 0, cl, ch, sl, sh, r;
+
+    cl = editorMinimapChunkOf(lo, &sl);
+    ch = editorMinimapChunkOf(hi - 1, &sh);
+    for (r = lo; r < sl + E.minimap.chunks[cl].rows && r < hi; r++)
+        if (E.row[r].size > best) best = E.row[r].size;
+    if (cl == ch) return best;
+    for (r = sh; r < hi; r++)
+        if (E.row[r].size > best) best = E.row[r].size;
+    for (cl += E.minimap.size + 1, ch += E.minimap.size; cl < ch; cl /= 2, ch /= 2) {
+        if (cl & 1) best = E.minimap.max[cl] > best ? E.minimap.max[cl] : best, cl++;
+        if (ch & 1) --ch, best = E.minimap.max[ch] > best ? E.minimap.max[ch] : best;
+    }
+    return best;
+}
+
+/*
+ * Append the map cells of screen row y, after a space that separates them from the text.
+ */
+void editorMinimapDrawRow(struct abuf *ab, int y) {
+    int per = (E.numrows + 4 * E.screenrows - 1) / (4 * E.screenrows);
+    int first = editorRowToLine(E.rowoff), last;
+    int nrows = editorVisibleRows(), c, r, lit = 0;
+    unsigned char cells[MINIMAP_COLS] = {0};
+
+    if (!E.minimap.valid) editorMinimapBuild();
+    if (per < 1) per = 1;
+    last = E.rowoff + E.screenrows < nrows ? editorRowToLine(E.rowoff + E.screenrows) : E.numrows;
+
+    for (r = 0; r < 4; r++) {
+        static const unsigned char left[4] = {0x01, 0x02, 0x04, 0x40}, right[4] = {0x08, 0x10, 0x20, 0x80};
+        int lo = (y * 4 + r) * per, hi = lo + per, len;
+        if (lo >= E.numrows) break;
+        if (hi > E.numrows) hi = E.numrows;
+        if (lo < last && hi > first) lit = 1;
+        len = editorMinimapQuery(lo, hi);
+        for (c = 0; c < 2 * MINIMAP_COLS && len > c * MINIMAP_DOT; c++)
+            cells[c / 2] |= c % 2 ? right[r] : left[r];
+    }
+
+    abAppend(ab, lit ? " \x1b[36m" : " \x1b[2m", lit ? 6 : 5);
+    for (c = 0; c < MINIMAP_COLS; c++) {
+        // U+2800 plus the dot bits, in UTF-8
+        char utf8[3] = {(char)0xe2, (char)(0xa0 | cells[c] >> 6), (char)(0x80 | (cells[c] & 0x3f))};
+        abAppend(ab, utf8, 3);
+    }
+    abAppend(ab, "\x1b[m", 3);
+}
+
+/*** diff ***/
+
+/*
+ * Lines are compared by a 64 bit FNV-1a hash, so the diff itself only ever
+ * looks at two arrays of integers. Buffer rows cache theirs until they change.
+ */
+uint64_t editorHashLine(const char *s, int len) {
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t editorRowHash(erow *row) {
+    if (!row->hashed) {
+        row->hash = editorHashLine(row->chars, row->size);
+        row->hashed = 1;
+    }
+    return row->hash;
+}
+
+/*
+ * Read the lines of filename into an array of hashes, the same way
+ * editorLoad() splits them. Returns -1 if the file can't be read.
+ */
+int editorDiffLoad(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int cap = 0;
+
+    if (!fp) return -1;
+    E.diff.nold = 0;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
+        if (E.diff.nold == cap) {
+            cap = cap ? cap * 2 : 1024;
+            E.diff.old = realloc(E.diff.old, sizeof(uint64_t) * cap);
+            if (E.diff.old == NULL) die("realloc");
+        }
+        E.diff.old[E.diff.nold++] = editorHashLine(line, linelen);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Linear space Myers diff: find the middle snake of a[a0..a1) against
+ * b[b0..b1) with a forward and a backward search meeting in the middle,
+ * then solve the two halves on each side of it. Only two vectors of
+ * O(n + m) are live at any time, never the whole edit graph.
+ * Lines found only in a get adel set, lines found only in b get bins set.
+ */
+void editorDiffRange(const uint64_t *a, int a0, int a1, const uint64_t *b, int b0, int b1, char *adel, char *bins) {
+    int n, m, maxd, voff, vlen, delta, front, d, k, i;
+    int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+    int *v1, *v2;
+
+    // common prefix and suffix never take part in the search
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) a0++, b0++;
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) a1--, b1--;
+    if (a0 == a1 || b0 == b1) {
+        for (i = a0; i < a1; i++) adel[i] = 1;
+        for (i = b0; i < b1; i++) bins[i] = 1;
+        return;
+    }
+
+    a += a0;
+    b += b0;
+    n = a1 - a0;
+    m = b1 - b0;
+    maxd = (n + m + 1) / 2;
+    voff = maxd;
+    vlen = 2 * maxd + 2;
+    v1 = malloc(sizeof(int) * vlen);
+    v2 = malloc(sizeof(int) * vlen);
+    if (v1 == NULL || v2 == NULL) die("malloc");
+    for (i = 0; i < vlen; i++) v1[i] = v2[i] = -1;
+    v1[voff + 1] = v2[voff + 1] = 0;
+    delta = n - m;
+    front = delta % 2 != 0;
+
+    for (d = 0; d < maxd && d < DIFF_MAX_COST; d++) {
+        for (k = -d + k1start; k <= d - k1end; k += 2) {
+            int x, y, ko = voff + k;
+            if (k == -d || (k != d && v1[ko - 1] < v1[ko + 1]))
+                x = v1[ko + 1];
+            else
+                x = v1[ko - 1] + 1;
+            y = x - k;
+            while (x < n && y < m && a[x] == b[y]) x++, y++;
+            v1[ko] = x;
+            if (x > n) {
+                k1end += 2;
+            } else if (y > m) {
+                k1start += 2;
+            } else if (front) {
+                int k2o = voff + delta - k;
+                if (k2o >= 0 && k2o < vlen && v2[k2o] != -1 && x >= n - v2[k2o]) {
+                    free(v1);
+                    free(v2);
+                    editorDiffRange(a - a0, a0, a0 + x, b - b0, b0, b0 + y, adel, bins);
+                    editorDiffRange(a - a0, a0 + x, a1, b - b0, b0 + y, b1, adel, bins);
+                    return;
+                }
+            }
+        }
+        for (k = -d + k2start; k <= d - k2end; k += 2) {
+            int x, y, ko = voff + k;
+            if (k == -d || (k != d && v2[ko - 1] < v2[ko + 1]))
+                x = v2[ko + 1];
+            else
+                x = v2[ko - 1] + 1;
+            y = x - k;
+            while (x < n && y < m && a[n - x - 1] == b[m - y - 1]) x++, y++;
+            v2[ko] = x;
+            if (x > n) {
+                k2end += 2;
+            } else if (y > m) {
+                k2start += 2;
+            } else if (!front) {
+                int k1o = voff + delta - k;
+                if (k1o >= 0 && k1o < vlen && v1[k1o] != -1) {
+                    int x1 = v1[k1o];
+                    int y1 = voff + x1 - k1o;
+                    if (x1 >= n - x) {
+                        free(v1);
+                        free(v2);
+                        editorDiffRange(a - a0, a0, a0 + x1, b - b0, b0, b0 + y1, adel, bins);
+                        editorDiffRange(a - a0, a0 + x1, a1, b - b0, b0 + y1, b1, adel, bins);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    // too different to be worth the search: call the whole range replaced
+    free(v1);
+    free(v2);
+    for (i = 0; i < n; i++) adel[a0 + i] = 1;
+    for (i = 0; i < m; i++) bins[b0 + i] = 1;
+}
+
+/*
+ * Set the gutter marks of lines from..to-1 (and of the line a run of
+ * deletions ends on) from the map: '+' added, '~' changed, '-' for lines
+ * deleted just above an otherwise unchanged line. from starts a run, the
+ * lines between two matched ones are a run of its own.
+ */
+void editorDiffMarks(int from, int to) {
+    int j = from, prev = from > 0 ? E.diff.map[from - 1] : -1;
+
+    while (j < to) {
+        int start = j, next, dels, ins;
+        while (j < E.numrows && E.diff.map[j] == -1) j++;
+        next = j < E.numrows ? E.diff.map[j] : E.diff.nold;
+        dels = next - prev - 1;
+        ins = j - start;
+        for (; start < j; start++) E.diff.marks[start] = ins - (j - start) < dels ? '~' : '+';
+        if (j < E.numrows) E.diff.marks[j] = ' ';
+        if (dels > ins && E.numrows > 0) E.diff.marks[j < E.numrows ? j : E.numrows - 1] = '-';
+        prev = next;
+        j++;
+    }
+}
+
+/*
+ * Diff old[oa..ob) against buffer lines lo..hi-1 and store which old line
+ * each of them matched in map[lo..hi).
+ */
+void editorDiffMap(int oa, int ob, int lo, int hi) {
+    uint64_t *cur = malloc(sizeof(uint64_t) * (hi - lo + 1));
+    char *adel = calloc(ob - oa + 1, 1);
+    char *bins = calloc(hi - lo + 1, 1);
+    int i = 0, j;
+
+    if (cur == NULL || adel == NULL || bins == NULL) die("malloc");
+    for (j = lo; j < hi; j++) cur[j - lo] = editorRowHash(&E.row[j]);
+    editorDiffRange(oa < ob ? E.diff.old + oa : E.diff.old, 0, ob - oa, cur, 0, hi - lo, adel, bins);
+    for (j = 0; j < hi - lo; j++) {
+        if (bins[j]) {
+            E.diff.map[lo + j] = -1;
+            continue;
+        }
+        while (adel[i]) i++;
+        E.diff.map[lo + j] = oa + i++;
+    }
+    free(cur);
+    free(adel);
+    free(bins);
+}
+
+void editorDiffResize(int n) {
+    E.diff.map = realloc(E.diff.map, sizeof(int) * (n + 1));
+    E.diff.marks = realloc(E.diff.marks, n + 1);
+    if (E.diff.map == NULL || E.diff.marks == NULL) die("realloc");
+}
+
+/*
+ * Diff the whole buffer against the hashes loaded by editorDiffLoad().
+ */
+void editorDiffCompute() {
+    editorDiffResize(E.numrows);
+    editorDiffMap(0, E.diff.nold, 0, E.numrows);
+    editorDiffMarks(0, E.numrows);
+    E.diff.nmap = E.numrows;
+    E.diff.mapped = 1;
+    E.diff.changed = 0;
+    E.diff.computed = E.dirty;
+}
+
+/*
+ * Lines start..end were replaced by n others. Only remember where: the
+ * next refresh diffs that window, not the whole file.
+ */
+void editorDiffLinesReplaced(int start, int end, int n) {
+    int delta = n - (end - start + 1);
+
+    if (!E.diff.mapped) return;
+    if (!E.diff.changed) {
+        E.diff.changed = 1;
+        E.diff.lo = start;
+        E.diff.hi = start + n;
+        E.diff.shift = delta;
+        return;
+    }
+    E.diff.hi = E.diff.hi > end ? E.diff.hi + delta : E.diff.hi < start ? E.diff.hi : start;
+    if (E.diff.hi < start + n) E.diff.hi = start + n;
+    if (E.diff.lo > start) E.diff.lo = start;
+    E.diff.shift += delta;
+}
+
+/*
+ * Rediff the changed window, widened to the unchanged lines on each side:
+ * those were matched before and still are, so only old lines between
+ * their matches can pair up with the lines in between.
+ */
+void editorDiffUpdate() {
+    int lo = E.diff.lo, hi = E.diff.hi, tail = hi - E.diff.shift, oa, ob, from;
+
+    while (lo > 0 && E.diff.map[lo - 1] == -1) lo--;
+    while (tail < E.diff.nmap && E.diff.map[tail] == -1) tail++, hi++;
+    oa = lo > 0 ? E.diff.map[lo - 1] + 1 : 0;
+    ob = tail < E.diff.nmap ? E.diff.map[tail] : E.diff.nold;
+
+    if (E.numrows > E.diff.nmap) editorDiffResize(E.numrows);
+    memmove(&E.diff.map[hi], &E.diff.map[tail], sizeof(int) * (E.diff.nmap - tail));
+    memmove(&E.diff.marks[hi], &E.diff.marks[tail], E.diff.nmap - tail);
+    E.diff.nmap = E.numrows;
+    editorDiffMap(oa, ob, lo, hi);
+
+    from = lo;
+    if (from == E.numrows && from > 0) from--;  // deleted at the end: the '-' goes on the last line
+    while (from > 0 && E.diff.map[from - 1] == -1) from--;
+    editorDiffMarks(from, hi < E.numrows ? hi + 1 : E.numrows);
+    E.diff.changed = 0;
+}
+
+/*
+ * Called before every refresh: redo the diff only if the buffer changed.
+ */
+void editorDiffRefresh() {
+    if (!E.diff.active || E.diff.computed == E.dirty) return;
+    if (!E.diff.mapped)
+        editorDiffCompute();
+    else if (E.diff.changed)
+        editorDiffUpdate();
+    E.diff.computed = E.dirty;
+}
+
+void editorDiffClose() {
+    E.diff.active = 0;
+    free(E.diff.against);
+    E.diff.against = NULL;
+    free(E.diff.marks);
+    E.diff.marks = NULL;
+    free(E.diff.map);
+    E.diff.map = NULL;
+    E.diff.mapped = 0;
+}
+
+/*
+ * Ctrl-D: show a gutter of changes against the saved file, or against
+ * another file typed at the prompt. Pressed again it hides the gutter.
+ */
+void editorDiffToggle() {
+    char *against;
+
+    if (E.diff.active) {
+        editorDiffClose();
+        return;
+    }
+
+    against = editorPrompt("Diff against (Enter for saved file): %s", NULL);
+    if (against == NULL) return;
+    if (against[0] == '\0') {
+        free(against);
+        if (E.filename == NULL) return;
+        against = strdup(E.filename);
+    }
+    if (editorDiffLoad(against) == -1) {
+        free(against);
+        return;
+    }
+    E.diff.active = 1;
+    E.diff.against = against;
+    editorDiffCompute();
+}
+
+/*
+ * After a save the file on disk is the buffer: reload it if that is what we diff against.
+ */
+void editorDiffSaved() {
+    if (!E.diff.active || E.filename == NULL || strcmp(E.diff.against, E.filename) != 0) return;
+    editorDiffLoad(E.diff.against);
+    editorDiffCompute();
+}
+
+/*** side by side diff ***/
+
+/*
+ * kilo -d a b shows two files next to each other, aligned line by line.
+ * Both files are mmap'd and only indexed (line offsets and hashes), the
+ * text is read straight from the mapping for the rows on screen.
+ */
+
+/*
+ * Text of line i without its line ending.
+ */
+const char *editorSbsLine(struct sbsFile *f, int i, int *len) {
+    size_t start = f->starts[i], end = f->starts[i + 1];
+    while (end > start && (f->map[end - 1] == '\n' || f->map[end - 1] == '\r')) end--;
+    *len = end - start > INT_MAX ? INT_MAX : (int)(end - start);
+    return f->map + start;
+}
+
+/*
+ * Map filename and record where each line starts and its hash.
+ * Returns -1 if it can't be opened.
+ */
+int editorSbsLoad(struct sbsFile *f, const char *filename) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    size_t pos = 0;
+    int cap = 0;
+
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    f->size = st.st_size;
+    f->map = NULL;
+    if (f->size > 0) {
+        f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (f->map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    f->nlines = 0;
+    f->starts = NULL;
+    f->hashes = NULL;
+    while (pos < f->size) {
+        char *nl = memchr(f->map + pos, '\n', f->size - pos);
+        size_t end = nl ? (size_t)(nl - f->map) + 1 : f->size;
+        if (f->nlines + 1 >= cap) {
+            cap = cap ? cap * 2 : 1024;
+            f->starts = realloc(f->starts, sizeof(size_t) * cap);
+            f->hashes = realloc(f->hashes, sizeof(uint64_t) * cap);
+            if (f->starts == NULL || f->hashes == NULL) die("realloc");
+        }
+        f->starts[f->nlines] = pos;
+        f->nlines++;
+        pos = end;
+    }
+    f->starts = realloc(f->starts, sizeof(size_t) * (f->nlines + 1));
+    if (f->starts == NULL) die("realloc");
+    f->starts[f->nlines] = f->size;
+    for (cap = 0; cap < f->nlines; cap++) {
+        int len;
+        const char *s = editorSbsLine(f, cap, &len);
+        f->hashes[cap] = editorHashLine(s, len);
+    }
+    return 0;
+}
+
+/*
+ * Patience anchoring: lines that occur exactly once in each file, kept
+ * in the longest run that is in the same order in both. These are almost
+ * always real matches (a closing brace or a blank line never is one), and
+ * they cut the input into independent regions for the Myers diff.
+ * Returns the number of anchors; (*pa)[i] in a matches (*pb)[i] in b.
+ */
+int editorSbsAnchors(struct sbsFile *a, struct sbsFile *b, int **pa, int **pb) {
+    struct sbsSlot {
+        uint64_t hash;
+        int ca, cb;  // occurrences in a and b, counting stops at 2
+        int ib;      // where it is in b
+    } *table;
+    size_t size = 1, mask, h;
+    int i, n = 0, len = 0, *cand_a, *cand_b, *tails, *prev;
+
+    while (size < 2 * (size_t)(a->nlines + b->nlines) + 2) size *= 2;
+    mask = size - 1;
+    table = calloc(size, sizeof(struct sbsSlot));
+    if (table == NULL) die("calloc");
+
+    // the table is keyed by line hash, a slot with ca == cb == 0 is free
+    for (i = 0; i < a->nlines + b->nlines; i++) {
+        int ina = i < a->nlines;
+        uint64_t hash = ina ? a->hashes[i] : b->hashes[i - a->nlines];
+        for (h = hash & mask; table[h].ca || table[h].cb; h = (h + 1) & mask)
+            if (table[h].hash == hash) break;
+        table[h].hash = hash;
+        if (ina) {
+            if (table[h].ca < 2) table[h].ca++;
+        } else {
+            if (table[h].cb < 2) table[h].cb++;
+            table[h].ib = i - a->nlines;
+        }
+    }
+
+    cand_a = malloc(sizeof(int) * (a->nlines + 1));
+    cand_b = malloc(sizeof(int) * (a->nlines + 1));
+    if (cand_a == NULL || cand_b == NULL) die("malloc");
+    for (i = 0; i < a->nlines; i++) {
+        for (h = a->hashes[i] & mask; table[h].hash != a->hashes[i]; h = (h + 1) & mask);
+        if (table[h].ca == 1 && table[h].cb == 1) {
+            cand_a[n] = i;
+            cand_b[n] = table[h].ib;
+            n++;
+        }
+    }
+    free(table);
+
+    // longest increasing subsequence of cand_b, by patience sorting
+    tails = malloc(sizeof(int) * (n + 1));
+    prev = malloc(sizeof(int) * (n + 1));
+    if (tails == NULL || prev == NULL) die("malloc");
+    for (i = 0; i < n; i++) {
+        int lo = 0, hi = len;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cand_b[tails[mid]] < cand_b[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[i] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == len) len++;
+    }
+
+    *pa = malloc(sizeof(int) * (len + 1));
+    *pb = malloc(sizeof(int) * (len + 1));
+    if (*pa == NULL || *pb == NULL) die("malloc");
+    for (i = len ? tails[len - 1] : -1, n = len; i != -1; i = prev[i]) {
+        n--;
+        (*pa)[n] = cand_a[i];
+        (*pb)[n] = cand_b[i];
+    }
+    free(cand_a);
+    free(cand_b);
+    free(tails);
+    free(prev);
+    return len;
+}
+
+void editorSbsAddRun(int a, int b, int na, int nb, int changed) {
+    struct sbsRun *run;
+    if (na == 0 && nb == 0) return;
+    if (E.sbs.nruns == E.sbs.cap) {
+        E.sbs.cap = E.sbs.cap ? E.sbs.cap * 2 : 256;
+        E.sbs.runs = realloc(E.sbs.runs, sizeof(struct sbsRun) * E.sbs.cap);
+        if (E.sbs.runs == NULL) die("realloc");
+    }
+    run = &E.sbs.runs[E.sbs.nruns++];
+    run->a = a;
+    run->b = b;
+    run->na = na;
+    run->nb = nb;
+    run->changed = changed;
+    run->row = E.sbs.nrows;
+    E.sbs.nrows += na > nb ? na : nb;
+}
+
+/*
+ * Diff the two files and turn the result into runs of aligned rows:
+ * equal runs (na == nb, same text) and change blocks.
+ */
+void editorSbsCompute() {
+    struct sbsFile *a = &E.sbs.a, *b = &E.sbs.b;
+    char *adel = calloc(a->nlines + 1, 1);
+    char *bins = calloc(b->nlines + 1, 1);
+    int *pa, *pb, nanchors, k, i = 0, j = 0;
+
+    if (adel == NULL || bins == NULL) die("calloc");
+    nanchors = editorSbsAnchors(a, b, &pa, &pb);
+    for (k = 0; k <= nanchors; k++) {
+        int a1 = k < nanchors ? pa[k] : a->nlines;
+        int b1 = k < nanchors ? pb[k] : b->nlines;
+        editorDiffRange(a->hashes, i, a1, b->hashes, j, b1, adel, bins);
+        i = a1 + 1;
+        j = b1 + 1;
+    }
+    free(pa);
+    free(pb);
+
+    i = j = 0;
+    while (i < a->nlines || j < b->nlines) {
+        int si = i, sj = j;
+        while (i < a->nlines && j < b->nlines && !adel[i] && !bins[j]) i++, j++;
+        editorSbsAddRun(si, sj, i - si, j - sj, 0);
+        si = i, sj = j;
+        while (i < a->nlines && adel[i]) i++;
+        while (j < b->nlines && bins[j]) j++;
+        editorSbsAddRun(si, sj, i - si, j - sj, 1);
+    }
+    free(adel);
+    free(bins);
+}
+
+void editorSbsOpen(char *left, char *right) {
+    if (editorSbsLoad(&E.sbs.a, left) == -1) die(left);
+    if (editorSbsLoad(&E.sbs.b, right) == -1) die(right);
+    E.sbs.active = 1;
+    editorSbsCompute();
+}
+
+/*
+ * Run holding aligned row r, by binary search on the runs' first rows.
+ */
+int editorSbsRunAt(int r) {
+    int lo = 0, hi = E.sbs.nruns - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (E.sbs.runs[mid].row <= r)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+void editorSbsDrawSide(struct abuf *ab, struct sbsFile *f, int line, const char *color, int width) {
+    int len = 0, skip;
+    const char *s = "";
+
+    if (line != -1) s = editorSbsLine(f, line, &len);
+    skip = E.coloff < len ? E.coloff : len;
+    s += skip;
+    len -= skip;
+    if (len > width) len = width;
+    if (color) abAppend(ab, color, 5);
+    editorDrawText(ab, s, len);
+    if (color) abAppend(ab, "\x1b[39m", 5);
+    while (len++ < width) abAppend(ab, " ", 1);
+}
+
+/*
+ * Draw aligned row r: deleted lines red on the left, added ones green on
+ * the right, changed ones yellow on both sides.
+ */
+void editorSbsDrawRow(struct abuf *ab, int r) {
+    struct sbsRun *run = &E.sbs.runs[editorSbsRunAt(r)];
+    int o = r - run->row;
+    int width = (E.screencols - 1) / 2;
+    int la = o < run->na ? run->a + o : -1;
+    int lb = o < run->nb ? run->b + o : -1;
+    const char *ca = NULL, *cb = NULL;
+
+    if (run->changed) {
+        ca = lb == -1 ? "\x1b[31m" : "\x1b[33m";
+        cb = la == -1 ? "\x1b[32m" : "\x1b[33m";
+    }
+    editorSbsDrawSide(ab, &E.sbs.a, la, ca, width);
+    abAppend(ab, run->changed ? "#" : "|", 1);
+    editorSbsDrawSide(ab, &E.sbs.b, lb, cb, E.screencols - 1 - width);
+}
+
+/*
+ * Move to the first row of the next ('n') or previous ('N') change block.
+ */
+void editorSbsNextChange(int dir) {
+    int i = editorSbsRunAt(E.cy) + dir;
+    for (; i >= 0 && i < E.sbs.nruns; i += dir) {
+        if (E.sbs.runs[i].changed) {
+            E.cy = E.sbs.runs[i].row;
+            E.rowoff = E.cy;  // show the change at the top of the screen
+            return;
+        }
+    }
+}
+
+void editorSbsProcessKey(int c) {
+    int times;
+
+    switch (c) {
+        case CTRL_KEY('q'):
+            write(STDOUT_FILENO, "\x1b[2J", 4);
+            write(STDOUT_FILENO, "\x1b[H", 3);
+            exit(0);
+            break;
+
+        case 'j':
+        case ARROW_UP:
+            if (E.cy > 0) E.cy--;
+            break;
+
+        case 'k':
+        case ARROW_DOWN:
+            if (E.cy < E.sbs.nrows - 1) E.cy++;
+            break;
+
+        case 'h':
+        case ARROW_LEFT:
+            if (E.coloff > 0) E.coloff--;
+            break;
+
+        case 'l':
+        case ARROW_RIGHT:
+            E.coloff++;
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN:
+            times = E.screenrows;
+            while (times--) editorSbsProcessKey(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+            break;
+
+        case 'g':
+            E.cy = 0;
+            break;
+
+        case 'G':
+            E.cy = E.sbs.nrows ? E.sbs.nrows - 1 : 0;
+            break;
+
+        case 'n':
+            editorSbsNextChange(1);
+            break;
+
+        case 'N':
+            editorSbsNextChange(-1);
+            break;
+    }
+}
+
+/*** completion ***/
+
+/*
+ * The completion index is a sorted array of every identifier in the
+ * buffer with how many times it occurs. It is built the first time it is
+ * needed, after that each row edit takes the row's words out before the
+ * change and puts them back after, so it never has to be rebuilt.
+ */
+
+int editorIsWordChar(int c) { return isalnum(c) || c == '_'; }
+
+/*
+ * Compare entry with the len bytes at word, like strcmp().
+ */
+int editorWordCmp(const char *entry, const char *word, int len) {
+    int r = strncmp(entry, word, len);
+    if (r != 0) return r;
+    return entry[len] != '\0';
+}
+
+/*
+ * Index of the first entry not less than word/len.
+ */
+int editorWordLowerBound(const char *word, int len) {
+    int lo = 0, hi = E.words.len;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (editorWordCmp(E.words.w[mid].word, word, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void editorWordAdd(const char *word, int len, int delta) {
+    int i = editorWordLowerBound(word, len);
+
+    if (i < E.words.len && editorWordCmp(E.words.w[i].word, word, len) == 0) {
+        E.words.w[i].count += delta;
+        if (E.words.w[i].count <= 0) {
+            free(E.words.w[i].word);
+            memmove(&E.words.w[i], &E.words.w[i + 1], sizeof(struct wordEntry) * (E.words.len - i - 1));
+            E.words.len--;
+        }
+        return;
+    }
+    if (delta <= 0) return;
+
+    if (E.words.len == E.words.cap) {
+        E.words.cap = E.words.cap ? E.words.cap * 2 : 1024;
+        E.words.w = realloc(E.words.w, sizeof(struct wordEntry) * E.words.cap);
+        if (E.words.w == NULL) die("realloc");
+    }
+    memmove(&E.words.w[i + 1], &E.words.w[i], sizeof(struct wordEntry) * (E.words.len - i));
+    E.words.w[i].word = malloc(len + 1);
+    if (E.words.w[i].word == NULL) die("malloc");
+    memcpy(E.words.w[i].word, word, len);
+    E.words.w[i].word[len] = '\0';
+    E.words.w[i].count = delta;
+    E.words.len++;
+}
+
+/*
+ * Add (delta 1) or remove (delta -1) the identifiers of a row: runs of
+ * letters, digits and '_' that don't start with a digit, 2 bytes or longer.
+ */
+void editorWordsScanRow(erow *row, int delta) {
+    int i = 0;
+    while (i < row->size) {
+        int start;
+        if (!editorIsWordChar((unsigned char)row->chars[i])) {
+            i++;
+            continue;
+        }
+        start = i;
+        while (i < row->size && editorIsWordChar((unsigned char)row->chars[i])) i++;
+        if (i - start >= 2 && !isdigit((unsigned char)row->chars[start]))
+            editorWordAdd(&row->chars[start], i - start, delta);
+    }
+}
+
+void editorWordsBuild() {
+    int i;
+    for (i = 0; i < E.numrows; i++) editorWordsScanRow(&E.row[i], 1);
+    E.words.built = 1;
+}
+
+/*
+ * Hooks for the row operations, they do nothing until the index exists.
+ */
+void editorWordsRowRemoved(erow *row) {
+    if (E.words.built) editorWordsScanRow(row, -1);
+}
+
+void editorWordsRowAdded(erow *row) {
+    if (E.words.built) editorWordsScanRow(row, 1);
+}
+
+/*
+ * Fill out with up to max words starting with prefix (but longer than
+ * it), most frequent first. Returns how many were found.
+ */
+int editorWordsComplete(const char *prefix, int len, char **out, int max) {
+    int counts[COMPLETE_MAX];
+    int i, n = 0;
+
+    if (!E.words.built) editorWordsBuild();
+    for (i = editorWordLowerBound(prefix, len); i < E.words.len; i++) {
+        struct wordEntry *we = &E.words.w[i];
+        int j;
+        if (strncmp(we->word, prefix, len) != 0) break;
+        if (we->word[len] == '\0') continue;
+        // insertion into the top-max list, kept sorted by count
+        if (n == max && we->count <= counts[n - 1]) continue;
+        j = n < max ? n++ : n - 1;
+        while (j > 0 && counts[j - 1] < we->count) {
+            counts[j] = counts[j - 1];
+            out[j] = out[j - 1];
+            j--;
+        }
+        counts[j] = we->count;
+        out[j] = we->word;
+    }
+    for (i = 0; i < n; i++) out[i] = strdup(out[i]);
+    return n;
+}
+
+void editorCompleteReset() {
+    int i;
+    for (i = 0; i < E.complete.n; i++) free(E.complete.cands[i]);
+    E.complete.n = 0;
+    E.complete.active = 0;
+}
+
+/*
+ * Ctrl-N in insert mode: complete the word before the cursor with the most
+ * frequent identifier starting with it. Pressed again, it replaces that
+ * with the next candidate, wrapping back to what was typed.
+ */
+void editorComplete() {
+    erow *row;
+    int start, len, next;
+    const char *word;
+
+    if (E.cy >= editorVisibleRows()) return;
+    row = &E.row[editorRowToLine(E.cy)];
+
+    if (!E.complete.active) {
+        start = E.cx;
+        while (start > 0 && editorIsWordChar((unsigned char)row->chars[start - 1])) start--;
+        if (start == E.cx) return;
+        E.complete.start = start;
+        E.complete.typed = E.cx - start;
+        E.complete.n = editorWordsComplete(&row->chars[start], E.cx - start, E.complete.cands, COMPLETE_MAX);
+        if (E.complete.n == 0) return;
+        E.complete.active = 1;
+        E.complete.idx = -1;
+    }
+
+    // take out what the previous Ctrl-N put in, then put the next one in
+    while (E.cx > E.complete.start + E.complete.typed) editorDelChar();
+    next = E.complete.idx + 1;
+    if (next > E.complete.n) next = 0;
+    E.complete.idx = next;
+    if (next == E.complete.n) return;  // back to just the typed prefix
+    word = E.complete.cands[next];
+    len = strlen(word);
+    for (start = E.complete.typed; start < len; start++) editorInsertChar(word[start]);
+}
+
+/*** statistics ***/
+
+/*
+ * W shows wc style counts of the buffer in the status bar. They are kept
+ * as running totals: every row is counted once when it appears, and
+ * again (negatively) before it changes or goes away, so a keystroke costs
+ * the length of one row whatever the size of the file. Each row keeps its
+ * own counts, so taking it away, or putting it back from a register, costs
+ * nothing per byte. Lines and bytes count the '\n' each row is saved
+ * with, like wc does.
+ */
+
+/*
+ * Count the UTF-8 sequences in s 8 bytes at a time: every byte that isn't
+ * a continuation byte (10xxxxxx) starts one.
+ */
+long long editorCountCodepoints(const char *s, int len) {
+    const uint64_t high = 0x8080808080808080ULL;
+    long long cont = 0;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x, m;
+        memcpy(&x, s + i, 8);
+        m = x & ~(x << 1) & high;  // bit 7 set and bit 6 clear, per byte
+        cont += (long long)(((m >> 7) * 0x0101010101010101ULL) >> 56);
+    }
+    for (; i < len; i++)
+        if (((unsigned char)s[i] & 0xc0) == 0x80) cont++;
+    return len - cont;
+}
+
+/*
+ * Count the words and codepoints of row, for editorStatsRow().
+ */
+void editorStatsCount(erow *row) {
+    int i, inword = 0;
+
+    row->words = 0;
+    for (i = 0; i < row->size; i++) {
+        int space = isspace((unsigned char)row->chars[i]);
+        if (!space && !inword) row->words++;
+        inword = !space;
+    }
+    row->codepoints = editorCountCodepoints(row->chars, row->size);
+}
+
+/*
+ * Add (sign 1) or take away (sign -1) the counts of row.
+ */
+void editorStatsRow(const erow *row, int sign) {
+    E.stats.words += sign * row->words;
+    E.stats.chars += sign * row->codepoints;
+    E.stats.bytes += sign * row->size;
+}
+
+/*** language server ***/
+
+/*
+ * With $KILO_LSP set to a command (e.g. "clangd"), the editor runs it as a
+ * language server and talks JSON-RPC to it over its stdin/stdout. After
+ * the didOpen with the initial text, every edit is sent as a small range
+ * change taken from the row operations, never the whole document again.
+ * Both pipes are non-blocking and are only pumped while waiting for a key
+ * in editorReadKey(), so a slow or chatty server never delays a keystroke:
+ * what can't be written yet stays queued, what was read gets parsed later.
+ */
+
+void editorLspQueue(const char *body, int len) {
+    char header[64];
+    int hlen = snprintf(header, sizeof(header), "Content-Length: %d\r\n\r\n", len);
+    abAppend(&E.lsp.out, header, hlen);
+    abAppend(&E.lsp.out, body, len);
+}
+
+/*
+ * Append s to ab as the inside of a JSON string.
+ */
+void editorJsonEscape(struct abuf *ab, const char *s, int len) {
+    int i, start = 0;
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        char esc[8];
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+        abAppend(ab, &s[start], i - start);
+        if (c == '"' || c == '\\')
+            snprintf(esc, sizeof(esc), "\\%c", c);
+        else if (c == '\n')
+            snprintf(esc, sizeof(esc), "\\n");
+        else if (c == '\t')
+            snprintf(esc, sizeof(esc), "\\t");
+        else
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+        abAppend(ab, esc, strlen(esc));
+        start = i + 1;
+    }
+    abAppend(ab, &s[start], len - start);
+}
+
+/*
+ * The file:// URI of path, with every byte but letters, digits, "-._~"
+ * and '/' percent-encoded. That also leaves nothing to escape in JSON.
+ */
+char *editorLspUri(const char *path) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t i, n = strlen(path);
+    char *uri = malloc(7 + 3 * n + 1), *p;
+
+    if (uri == NULL) die("malloc");
+    memcpy(uri, "file://", 7);
+    for (i = 0, p = uri + 7; i < n; i++) {
+        unsigned char c = path[i];
+        if (isalnum(c) || strchr("-._~/", c)) {
+            *p++ = c;
+        } else {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        }
+    }
+    *p = '\0';
+    return uri;
+}
+
+/*
+ * Start the server if $KILO_LSP is set and it isn't running yet.
+ */
+int editorLspStart() {
+    const char *cmd = getenv("KILO_LSP");
+    const char *initialized = "{\"jsonrpc\":\"2.0\",\"method\":\"initialized\",\"params\":{}}";
+    struct abuf ab = ABUF_INIT;
+    int in[2], out[2];
+    char head[128], cwd[PATH_MAX], *root;
+    int len;
+
+    if (E.lsp.pid > 0) return 0;
+    if (cmd == NULL || *cmd == '\0' || getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+    if (pipe(in) == -1) return -1;
+    if (pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    E.lsp.pid = fork();
+    if (E.lsp.pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        if (devnull != -1) dup2(devnull, STDERR_FILENO);  // keep it off our screen
+        close(in[1]);
+        close(out[0]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (E.lsp.pid == -1) {
+        close(in[1]);
+        close(out[0]);
+        return -1;
+    }
+    E.lsp.to = in[1];
+    E.lsp.from = out[0];
+    fcntl(E.lsp.to, F_SETFL, fcntl(E.lsp.to, F_GETFL) | O_NONBLOCK);
+    fcntl(E.lsp.from, F_SETFL, fcntl(E.lsp.from, F_GETFL) | O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);  // a dead server must not take the editor with it
+
+    len = snprintf(head, sizeof(head),
+                   "{\"jsonrpc\":\"2.0\",\"id\":%d,\"method\":\"initialize\",\"params\":{\"processId\":%d,"
+                   "\"rootUri\":\"",
+                   ++E.lsp.nextid, (int)getpid());
+    abAppend(&ab, head, len);
+    root = editorLspUri(cwd);
+    abAppend(&ab, root, strlen(root));
+    free(root);
+    abAppend(&ab, "\",\"capabilities\":{\"general\":{\"positionEncodings\":[\"utf-8\"]}}}}", 62);
+    editorLspQueue(ab.b, ab.len);
+    abFree(&ab);
+    editorLspQueue(initialized, strlen(initialized));
+    return 0;
+}
+
+const char *editorLspLanguage(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    if (ext == NULL) return "plaintext";
+    if (!strcmp(ext, ".c") || !strcmp(ext, ".h")) return "c";
+    if (!strcmp(ext, ".cc") || !strcmp(ext, ".cpp") || !strcmp(ext, ".hpp")) return "cpp";
+    if (!strcmp(ext, ".py")) return "python";
+    if (!strcmp(ext, ".js")) return "javascript";
+    if (!strcmp(ext, ".ts")) return "typescript";
+    if (!strcmp(ext, ".go")) return "go";
+    if (!strcmp(ext, ".rs")) return "rust";
+    return "plaintext";
+}
+
+/*
+ * Send didOpen for the buffer just loaded. The only time the whole text goes over the pipe.
+ */
+void editorLspOpenDocument() {
+    struct abuf ab = ABUF_INIT;
+    char path[PATH_MAX], tail[64];
+    int i, len;
+
+    if (E.filename == NULL || editorLspStart() == -1) return;
+    if (realpath(E.filename, path) == NULL) snprintf(path, sizeof(path), "%s", E.filename);
+    free(E.lsp.uri);
+    E.lsp.uri = editorLspUri(path);
+    E.lsp.version = 1;
+
+    abAppend(&ab,
+             "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":"
+             "{\"uri\":\"",
+             82);
+    abAppend(&ab, E.lsp.uri, strlen(E.lsp.uri));
+    len = snprintf(tail, sizeof(tail), "\",\"languageId\":\"%s\",\"version\":1,\"text\":\"",
+                   editorLspLanguage(E.filename));
+    abAppend(&ab, tail, len);
+    for (i = 0; i < E.numrows; i++) {
+        editorJsonEscape(&ab, E.row[i].chars, E.row[i].size);
+        abAppend(&ab, "\\n", 2);
+    }
+    abAppend(&ab, "\"}}}", 4);
+    editorLspQueue(ab.b, ab.len);
+    abFree(&ab);
+    E.lsp.opened = 1;
+}
+
+void editorLspCloseDocument() {
+    struct abuf ab = ABUF_INIT;
+
+    if (!E.lsp.opened) return;
+    abAppend(&ab,
+             "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didClose\",\"params\":{\"textDocument\":"
+             "{\"uri\":\"",
+             83);
+    abAppend(&ab, E.lsp.uri, strlen(E.lsp.uri));
+    abAppend(&ab, "\"}}}", 4);
+    editorLspQueue(ab.b, ab.len);
+    abFree(&ab);
+    E.lsp.opened = 0;
+    E.lsp.changes.len = 0;
+}
+
+/*
+ * Record that the text between (l1, c1) and (l2, c2) became text.
+ * Changes are batched and go out as one didChange per keypress.
+ */
+void editorLspChange(int l1, int c1, int l2, int c2, const char *text, int len) {
+    char range[128];
+    int rlen;
+
+    if (!E.lsp.opened) return;
+    rlen = snprintf(range, sizeof(range),
+                    "%s{\"range\":{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}},"
+                    "\"text\":\"",
+                    E.lsp.changes.len ? "," : "", l1, c1, l2, c2);
+    abAppend(&E.lsp.changes, range, rlen);
+    editorJsonEscape(&E.lsp.changes, text, len);
+    abAppend(&E.lsp.changes, "\"}", 2);
+}
+
+void editorLspFlushChanges() {
+    struct abuf ab = ABUF_INIT;
+    char tail[64];
+    int len;
+
+    if (E.lsp.changes.len == 0) return;
+    abAppend(&ab,
+             "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":"
+             "{\"uri\":\"",
+             84);
+    abAppend(&ab, E.lsp.uri, strlen(E.lsp.uri));
+    len = snprintf(tail, sizeof(tail), "\",\"version\":%d},\"contentChanges\":[", ++E.lsp.version);
+    abAppend(&ab, tail, len);
+    abAppend(&ab, E.lsp.changes.b, E.lsp.changes.len);
+    abAppend(&ab, "]}}", 3);
+    editorLspQueue(ab.b, ab.len);
+    abFree(&ab);
+    E.lsp.changes.len = 0;
+}
+
+/*
+ * Look at one complete message from the server. Only diagnostics for
+ * our document are used for now: how many there are.
+ */
+void editorLspHandle(const char *msg, int len) {
+    const char *p, *end = msg + len;
+
+    E.lsp.received++;
+    if (!memmem(msg, len, "\"textDocument/publishDiagnostics\"", 33)) return;
+    if (E.lsp.uri == NULL || !memmem(msg, len, E.lsp.uri, strlen(E.lsp.uri))) return;
+    E.lsp.diagnostics = 0;
+    for (p = msg; (p = memmem(p, end - p, "\"severity\"", 10)) != NULL; p += 10) E.lsp.diagnostics++;
+}
+
+/*
+ * Forget a server that exited or hung up. The next file opened starts it again.
+ */
+void editorLspStop() {
+    close(E.lsp.to);
+    close(E.lsp.from);
+    kill(E.lsp.pid, SIGTERM);
+    waitpid(E.lsp.pid, NULL, 0);
+    free(E.lsp.uri);
+    abFree(&E.lsp.out);
+    abFree(&E.lsp.in);
+    abFree(&E.lsp.changes);
+    memset(&E.lsp, 0, sizeof(E.lsp));
+}
+
+/*
+ * Lines start..end are about to become the n lines of text, as one change.
+ */
+void editorLspReplaceLines(int start, int end, const char *text, size_t len, int n) {
+    size_t body = len > 0 && text[len - 1] == '\n' ? len - 1 : len;
+    const char *p;
+
+    if (!E.lsp.opened) return;
+    if (end < E.numrows - 1) {
+        editorLspChange(start, 0, end + 1, 0, text, body);
+        if (n > 0) {
+            for (p = text + body; p > text && p[-1] != '\n'; p--);
+            editorLspChange(start + n - 1, text + body - p, start + n - 1, text + body - p, "\n", 1);
+        }
+    } else if (n == 0 && start > 0) {
+        editorLspChange(start - 1, E.row[start - 1].size, end, E.row[end].size, "", 0);
+    } else {
+        editorLspChange(start, 0, end, E.row[end].size, text, body);
+    }
+}
+
+/*
+ * Move whatever can be moved without blocking: queued output to the
+ * server, and complete Content-Length framed messages from it.
+ */
+void editorLspPoll() {
+    char buf[4096];
+    ssize_t n;
+
+    if (E.lsp.pid <= 0) return;
+    editorLspFlushChanges();
+
+    while (E.lsp.sent < E.lsp.out.len) {
+        n = write(E.lsp.to, E.lsp.out.b + E.lsp.sent, E.lsp.out.len - E.lsp.sent);
+        if (n == -1 && errno != EAGAIN) {
+            editorLspStop();
+            return;
+        }
+        if (n <= 0) break;
+        E.lsp.sent += n;
+    }
+    if (E.lsp.sent == E.lsp.out.len) E.lsp.sent = E.lsp.out.len = 0;
+
+    while ((n = read(E.lsp.from, buf, sizeof(buf))) > 0) abAppend(&E.lsp.in, buf, n);
+    if (n == 0) {  // the server went away
+        editorLspStop();
+        return;
+    }
+
+    while (1) {
+        char *sep = E.lsp.in.len ? memmem(E.lsp.in.b, E.lsp.in.len, "\r\n\r\n", 4) : NULL;
+        char *cl;
+        int hlen, blen;
+
+        if (sep == NULL) break;
+        hlen = sep - E.lsp.in.b + 4;
+        cl = memmem(E.lsp.in.b, hlen, "Content-Length:", 15);
+        blen = cl ? atoi(cl + 15) : 0;
+        if (E.lsp.in.len < hlen + blen) break;
+        editorLspHandle(E.lsp.in.b + hlen, blen);
+        memmove(E.lsp.in.b, E.lsp.in.b + hlen + blen, E.lsp.in.len - hlen - blen);
+        E.lsp.in.len -= hlen + blen;
+    }
+}
+
+/*** spell checking ***/
+
+/*
+ * s underlines misspelled words on screen: all of them in prose, only in
+ * comments and strings in source files. The dictionary ($KILO_DICT, else
+ * /usr/share/dict/words, one word per line) is mmap'd and indexed once by
+ * an open addressing table of line offsets, with a bloom filter in front
+ * so most misspellings are rejected without touching the mapping. Only
+ * the rows being drawn get checked, a few hundred lookups per frame, so
+ * there is nothing to hand off to a worker and nothing a keystroke waits
+ * for.
+ */
+
+uint64_t editorSpellHash(const char *s, int len) {
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+ * The 3 bloom filter bits of a word, from the two halves of its hash.
+ */
+uint32_t editorSpellBit(uint64_t h, int k) {
+    return ((uint32_t)h + k * (uint32_t)((h >> 32) | 1)) % E.spell.bloombits;
+}
+
+int editorSpellLoad() {
+    const char *path = getenv("KILO_DICT");
+    struct stat st;
+    const char *p, *end, *nl;
+    uint32_t words = 0, cap = 1, i;
+    int fd;
+
+    if (path == NULL) path = "/usr/share/dict/words";
+    if ((fd = open(path, O_RDONLY)) == -1) return -1;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    E.spell.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (E.spell.map == MAP_FAILED) {
+        E.spell.map = NULL;
+        return -1;
+    }
+    E.spell.size = st.st_size;
+    end = E.spell.map + E.spell.size;
+
+    for (p = E.spell.map; p < end && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1) words++;
+    while (cap < 2 * words + 2) cap *= 2;  // keep the table at most half full
+    E.spell.mask = cap - 1;
+    E.spell.slots = calloc(cap, sizeof(uint32_t));
+    E.spell.bloombits = 16 * words + 64;  // about 0.2% false positives with 3 bits
+    E.spell.bloom = calloc(E.spell.bloombits / 64 + 1, sizeof(uint64_t));
+    if (E.spell.slots == NULL || E.spell.bloom == NULL) die("calloc");
+
+    for (p = E.spell.map; p < end; p = nl + 1) {
+        uint64_t h;
+        int len;
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL) nl = end;
+        len = nl - p;
+        if (len > 0 && p[len - 1] == '\r') len--;
+        if (len == 0) continue;
+        h = editorSpellHash(p, len);
+        for (i = 0; i < 3; i++) {
+            uint32_t bit = editorSpellBit(h, i);
+            E.spell.bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+        for (i = h & E.spell.mask; E.spell.slots[i]; i = (i + 1) & E.spell.mask);
+        E.spell.slots[i] = p - E.spell.map + 1;  // 0 marks an empty slot
+    }
+    E.spell.loaded = 1;
+    return 0;
+}
+
+int editorSpellKnown(const char *word, int len) {
+    uint64_t h = editorSpellHash(word, len);
+    uint32_t i;
+
+    for (i = 0; i < 3; i++) {
+        uint32_t bit = editorSpellBit(h, i);
+        if (!(E.spell.bloom[bit / 64] & ((uint64_t)1 << (bit % 64)))) return 0;
+    }
+    for (i = h & E.spell.mask; E.spell.slots[i]; i = (i + 1) & E.spell.mask) {
+        const char *entry = E.spell.map + E.spell.slots[i] - 1;
+        size_t left = E.spell.map + E.spell.size - entry;
+        if ((size_t)len <= left && strncasecmp(entry, word, len) == 0 &&
+            ((size_t)len == left || entry[len] == '\n' || entry[len] == '\r'))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Return marks for the bytes of the row, set for those that belong to
+ * misspelled words. Words are runs of letters with inner apostrophes. Ones
+ * that look like code or names (next to digits or '_', camelCase, ALLCAPS)
+ * are let be.
+ */
+char *editorSpellRow(erow *row) {
+    char *bad, *mask = NULL;
+    int i = 0, n = row->size;
+
+    if (n + 1 > E.spell.rowcap) {
+        E.spell.rowcap = n + 1 > E.spell.rowcap * 2 ? n + 1 : E.spell.rowcap * 2;
+        E.spell.bad = realloc(E.spell.bad, E.spell.rowcap);
+        E.spell.code = realloc(E.spell.code, E.spell.rowcap);
+        if (E.spell.bad == NULL || E.spell.code == NULL) die("realloc");
+    }
+    bad = E.spell.bad;
+    memset(bad, 0, n);
+    if (E.filename && strcmp(editorLspLanguage(E.filename), "plaintext") != 0) {
+        mask = E.spell.code;
+        editorCodeMask(row, mask);
+    }
+    while (i < n) {
+        const char *s = row->chars;
+        int start = i, len, upper = 0, inner = 0;
+        if (!isalpha((unsigned char)s[i]) || (mask && mask[i])) {
+            i++;
+            continue;
+        }
+        while (i < n && (isalpha((unsigned char)s[i]) || (s[i] == '\'' && i + 1 < n && isalpha((unsigned char)s[i + 1])))) {
+            if (isupper((unsigned char)s[i])) {
+                upper++;
+                if (i > start) inner = 1;
+            }
+            i++;
+        }
+        len = i - start;
+        if (len > 2 && s[i - 2] == '\'' && tolower((unsigned char)s[i - 1]) == 's') len -= 2;
+        if (len < 2 || inner || upper == len) continue;
+        if ((start > 0 && (isalnum((unsigned char)s[start - 1]) || s[start - 1] == '_')) ||
+            (i < n && (isdigit((unsigned char)s[i]) || s[i] == '_')))
+            continue;
+        if (!editorSpellKnown(&s[start], len)) memset(&bad[start], 1, len);
+    }
+    return bad;
+}
+
+/*
+ * editorDrawText() for len bytes of row from col on, misspellings underlined.
+ */
+void editorSpellDrawText(struct abuf *ab, erow *row, int col, int len) {
+    char *bad = editorSpellRow(row);
+    int i = col, end = col + len;
+
+    while (i < end) {
+        int j = i;
+        while (j < end && bad[j] == bad[i]) j++;
+        if (bad[i]) abAppend(ab, "\x1b[4;31m", 7);
+        editorDrawText(ab, &row->chars[i], j - i);
+        if (bad[i]) abAppend(ab, "\x1b[24;39m", 8);
+        i = j;
+    }
+}
+
+void editorSpellToggle() {
+    if (!E.spell.loaded && editorSpellLoad() == -1) {
+        editorSetStatusMessage("No dictionary: set KILO_DICT or install /usr/share/dict/words");
+        return;
+    }
+    E.spell.show = !E.spell.show;
+}
+
+/*** row operations ***/
+
+/*
+ * Called before the text of a row changes or the row goes away,
+ * with editorRowAdded() (through editorUpdateRow()) after.
+ */
+void editorRowWillChange(erow *row) {
+    editorWordsRowRemoved(row);
+    editorStatsRow(row, -1);
+}
+
+void editorRowAdded(erow *row) {
+    editorWordsRowAdded(row);
+    editorStatsCount(row);
+    editorStatsRow(row, 1);
+}
+
+/*
+ * Called whenever the text of a row changed, to refresh what is cached about it.
+ */
+void editorUpdateRow(erow *row) {
+    row->hashed = 0;
+    editorRowAdded(row);
+    editorBracketRowChanged(row - E.row);
+    editorMinimapRowChanged(row - E.row);
+    editorDiffLinesReplaced(row - E.row, row - E.row, 1);
+}
+
+void editorInsertRow(int at, const char *s, size_t len) {
+    if (at < 0 || at > E.numrows) return;
+    if (E.lsp.opened) {
+        if (at < E.numrows) {
+            editorLspChange(at, 0, at, 0, s, len);
+            editorLspChange(at, len, at, len, "\n", 1);
+        } else if (at > 0) {
+            int end = E.row[at - 1].size;
+            editorLspChange(at - 1, end, at - 1, end, "\n", 1);
+            editorLspChange(at, 0, at, 0, s, len);
+        } else {
+            editorLspChange(0, 0, 0, 0, s, len);
+        }
+    }
+
+    if (E.numrows == E.rowcap) {
+        E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+        if (E.row == NULL) die("realloc");
+    }
+    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+
+    E.row[at].size = len;
+    E.row[at].chars = malloc(len + 1);
+    memcpy(E.row[at].chars, s, len);
+    E.row[at].chars[len] = '\0';
+    E.row[at].hashed = 0;
+    E.row[at].refs = NULL;
+    editorRowAdded(&E.row[at]);
+
+    E.numrows++;
+    E.dirty++;
+    editorViewRowInserted(at);
+    editorFoldRowInserted(at);
+    editorBracketRowInserted(at);
+    editorMinimapRowInserted(at);
+    editorDiffLinesReplaced(at, at - 1, 1);
+}
+
+/*
+ * Reference counts come REFS_CHUNK at a time and go back on a free list
+ * threaded through the unused slots, so sharing millions of lines doesn't
+ * make millions of malloc() calls. The count starts at 1.
+ */
+int *editorRefAlloc() {
+    union refSlot *slot;
+    int i;
+
+    if (E.freerefs == NULL) {
+        slot = malloc(sizeof(*slot) * REFS_CHUNK);
+        if (slot == NULL) die("malloc");
+        for (i = 0; i < REFS_CHUNK - 1; i++) slot[i].next = &slot[i + 1];
+        slot[REFS_CHUNK - 1].next = NULL;
+        E.freerefs = slot;
+    }
+    slot = E.freerefs;
+    E.freerefs = slot->next;
+    slot->count = 1;
+    return &slot->count;
+}
+
+void editorRefFree(int *refs) {
+    union refSlot *slot = (union refSlot *)refs;
+
+    if (slot == NULL) return;
+    slot->next = E.freerefs;
+    E.freerefs = slot;
+}
+
+void editorFreeRow(erow *row) {
+    if (row->refs && --*row->refs > 0) return;  // a register still holds the text
+    editorRefFree(row->refs);
+    free(row->chars);
+}
+
+/*
+ * Another holder for row's text: returns a copy of the row sharing it.
+ */
+erow editorRowShare(erow *row) {
+    if (row->refs == NULL) row->refs = editorRefAlloc();
+    (*row->refs)++;
+    return *row;
+}
+
+/*
+ * Called before row's text changes in place: if a register shares it, the
+ * row gets a copy of its own first.
+ */
+void editorRowOwn(erow *row) {
+    char *chars;
+
+    if (row->refs == NULL) return;
+    if (--*row->refs == 0) {
+        editorRefFree(row->refs);
+    } else {
+        chars = malloc(row->size + 1);
+        if (chars == NULL) die("malloc");
+        memcpy(chars, row->chars, row->size + 1);
+        row->chars = chars;
+    }
+    row->refs = NULL;
+}
+
+void editorDelRow(int at) {
+    if (at < 0 || at >= E.numrows) return;
+    if (at < E.numrows - 1)
+        editorLspChange(at, 0, at + 1, 0, "", 0);
+    else if (at > 0)
+        editorLspChange(at - 1, E.row[at - 1].size, at, E.row[at].size, "", 0);
+    else
+        editorLspChange(0, 0, 0, E.row[0].size, "", 0);
+    editorRowWillChange(&E.row[at]);
+    editorFreeRow(&E.row[at]);
+    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+    E.numrows--;
+    E.dirty++;
+    editorViewRowDeleted(at);
+    editorFoldRowDeleted(at);
+    editorBracketRowDeleted(at);
+    editorMinimapRowDeleted(at);
+    editorDiffLinesReplaced(at, at, 0);
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+    if (at < 0 || at > row->size) at = row->size;
+    char ch = c;
+    editorLspChange(row - E.row, at, row - E.row, at, &ch, 1);
+    editorRowWillChange(row);
+    editorRowOwn(row);
+    row->chars = realloc(row->chars, row->size + 2);
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    E.dirty++;
+    editorUpdateRow(row);
+}
+
+void editorRowAppendString(erow *row, const char *s, size_t len) {
+    editorLspChange(row - E.row, row->size, row - E.row, row->size, s, len);
+    editorRowWillChange(row);
+    editorRowOwn(row);
+    row->chars = realloc(row->chars, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    E.dirty++;
+    editorUpdateRow(row);
+}
+
+void editorRowDelChar(erow *row, int at) {
+    if (at < 0 || at >= row->size) return;
+    editorLspChange(row - E.row, at, row - E.row, at + 1, "", 0);
+    editorRowWillChange(row);
+    editorRowOwn(row);
+    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    row->size--;
+    E.dirty++;
+    editorUpdateRow(row);
+}
+
+void editorRowTruncate(erow *row, int len) {
+    if (len < 0 || len >= row->size) return;
+    editorLspChange(row - E.row, len, row - E.row, row->size, "", 0);
+    editorRowWillChange(row);
+    editorRowOwn(row);
+    row->size = len;
+    row->chars[len] = '\0';
+    E.dirty++;
+    editorUpdateRow(row);
+}
+
+/*
+ * Lines start..end were replaced by n others: fix up what refers to lines by number.
+ * Folds inside the range are gone, the ones below move with the text.
+ */
+void editorLinesReplaced(int start, int end, int n) {
+    int delta = n - (end - start + 1), i, j;
+
+    editorFoldLinesReplaced(start, end, n);
+    if (E.view.active) {
+        for (i = j = 0; i < E.view.len; i++) {
+            if (E.view.lines[i] >= start && E.view.lines[i] <= end) continue;
+            E.view.lines[j++] = E.view.lines[i] > end ? E.view.lines[i] + delta : E.view.lines[i];
+        }
+        E.view.len = j;
+    }
+    editorBracketLinesReplaced(start, end, n);
+    editorMinimapLinesReplaced(start, end, n);
+    editorDiffLinesReplaced(start, end, n);
+    E.dirty++;
+}
+
+/*
+ * Replace lines start..end with the lines of text as a single edit: one
+ * change for the language server and one move of the rows below, instead
+ * of a delete and an insert per line. A last line without '\n' counts.
+ */
+void editorReplaceLines(int start, int end, const char *text, size_t len) {
+    const char *p, *nl, *stop = text + len;
+    int n = 0, delta, i, at;
+
+    if (start < 0 || end >= E.numrows || start > end) return;
+    for (p = text; p < stop; p = nl + 1) {
+        nl = memchr(p, '\n', stop - p);
+        if (nl == NULL) nl = stop;
+        n++;
+    }
+    delta = n - (end - start + 1);
+
+    editorLspReplaceLines(start, end, text, len, n);
+    for (i = start; i <= end; i++) {
+        editorRowWillChange(&E.row[i]);
+        editorFreeRow(&E.row[i]);
+    }
+    if (E.numrows + delta > E.rowcap) {
+        while (E.numrows + delta > E.rowcap) E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+        if (E.row == NULL) die("realloc");
+    }
+    memmove(&E.row[start + n], &E.row[end + 1], sizeof(erow) * (E.numrows - end - 1));
+    for (at = start, p = text; at < start + n; at++, p = nl + 1) {
+        erow *row = &E.row[at];
+        nl = memchr(p, '\n', stop - p);
+        if (nl == NULL) nl = stop;
+        row->size = nl - p;
+        row->chars = malloc(row->size + 1);
+        memcpy(row->chars, p, row->size);
+        row->chars[row->size] = '\0';
+        row->hashed = 0;
+        row->refs = NULL;
+        editorRowAdded(row);
+    }
+    E.numrows += delta;
+    editorLinesReplaced(start, end, n);
+}
+
+/*** editor operations ***/
+
+/*
+ * These work on the row under the cursor through editorRowToLine(), so they
+ * behave the same in the whole file and in a filtered view.
+ */
+void editorInsertChar(int c) {
+    if (editorVisibleRows() == 0) {
+        if (E.view.active) return;  // nothing matched, there is no line to type into
+        editorInsertRow(0, "", 0);
+    }
+    editorRowInsertChar(&E.row[editorRowToLine(E.cy)], E.cx, c);
+    E.cx++;
+}
+
+void editorInsertNewline() {
+    int line;
+
+    if (editorVisibleRows() == 0) {
+        if (E.view.active) return;
+        editorInsertRow(0, "", 0);
+    }
+    line = editorRowToLine(E.cy);
+    if (!E.view.active && editorFoldAt(line) != -1) editorFoldRemove(line);
+
+    erow *row = &E.row[line];
+    editorInsertRow(line + 1, &row->chars[E.cx], row->size - E.cx);
+    row = &E.row[line];  // editorInsertRow() may have moved the rows
+    editorRowTruncate(row, E.cx);
+
+    if (E.view.active) editorViewInsert(E.cy + 1, line + 1);
+    E.cy++;
+    E.cx = 0;
+}
+
+void editorDelChar() {
+    int line;
+
+    if (editorVisibleRows() == 0) return;
+    line = editorRowToLine(E.cy);
+    if (E.cx == 0 && line == 0) return;
+
+    erow *row = &E.row[line];
+    if (E.cx > 0) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+    } else {
+        // Only join with the line above when it is the row above on screen too,
+        // not a line hidden by the filter or inside a fold
+        if (E.cy == 0 || editorRowToLine(E.cy - 1) != line - 1) return;
+        E.cx = E.row[line - 1].size;
+        editorRowAppendString(&E.row[line - 1], row->chars, row->size);
+        editorDelRow(line);
+        E.cy--;
+    }
+}
+
+/*
+ * The lines a whole-buffer command works on: the closed fold under the
+ * cursor if there is one, else all of them.
+ */
+void editorTargetLines(int *start, int *end) {
+    int i;
+
+    *start = 0;
+    *end = E.numrows - 1;
+    if (E.cy < editorVisibleRows() && (i = editorFoldAt(editorRowToLine(E.cy))) != -1) {
+        *start = editorRowToLine(E.cy);
+        *end = i;
+    }
+}
+
+void editorReverseRows(int lo, int hi) {
+    for (hi--; lo < hi; lo++, hi--) {
+        erow row = E.row[lo];
+        E.row[lo] = E.row[hi];
+        E.row[hi] = row;
+    }
+}
+
+/*
+ * Rotate the rows lo..hi-1 so that mid comes first. A small block is set
+ * aside while the other one slides over in one memmove. When both are big,
+ * reversing each and then the whole of it needs no memory, and touching no
+ * fresh pages makes that faster than a big buffer.
+ */
+void editorRotateRows(int lo, int mid, int hi) {
+    int a = mid - lo, b = hi - mid;
+    erow *tmp;
+
+    if (a > ROTATE_BUFFER && b > ROTATE_BUFFER) {
+        editorReverseRows(lo, mid);
+        editorReverseRows(mid, hi);
+        editorReverseRows(lo, hi);
+        return;
+    }
+    tmp = malloc(sizeof(erow) * (a < b ? a : b));
+    if (tmp == NULL) die("malloc");
+    if (a <= b) {
+        memcpy(tmp, &E.row[lo], sizeof(erow) * a);
+        memmove(&E.row[lo], &E.row[mid], sizeof(erow) * b);
+        memcpy(&E.row[lo + b], tmp, sizeof(erow) * a);
+    } else {
+        memcpy(tmp, &E.row[mid], sizeof(erow) * b);
+        memmove(&E.row[lo + b], &E.row[lo], sizeof(erow) * a);
+        memcpy(&E.row[lo], tmp, sizeof(erow) * b);
+    }
+    free(tmp);
+}
+
+/*
+ * Move lines start..end below line to, -1 for the top, as one edit. The
+ * rows change places in the array and nothing else: no text is copied and
+ * the statistics don't change. The language server sees a delete and an
+ * insert.
+ */
+void editorMoveLines(int start, int end, int to) {
+    int n = end - start + 1, at = to < start ? to + 1 : to - n + 1;
+
+    if (to >= start - 1 && to <= end) {
+        if (to >= start && to < end) editorSetStatusMessage("Can't move lines into themselves");
+        return;
+    }
+    if (E.lsp.opened) {
+        struct abuf ab = ABUF_INIT;
+        int i, last = E.numrows - 1 - n;  // the last line once start..end are gone
+        if (at > last) abAppend(&ab, "\n", 1);
+        for (i = start; i <= end; i++) {
+            abAppend(&ab, E.row[i].chars, E.row[i].size);
+            if (i < end || at <= last) abAppend(&ab, "\n", 1);
+        }
+        editorLspReplaceLines(start, end, "", 0, 0);
+        if (at <= last)
+            editorLspChange(at, 0, at, 0, ab.b, ab.len);
+        else
+            editorLspChange(last, E.row[E.numrows - 1].size, last, E.row[E.numrows - 1].size, ab.b, ab.len);
+        abFree(&ab);
+    }
+    if (to > end) {
+        editorRotateRows(start, end + 1, to + 1);
+        editorLinesReplaced(start, to, to - start + 1);
+    } else {
+        editorRotateRows(to + 1, start, end + 1);
+        editorLinesReplaced(to + 1, end, end - to);
+    }
+    editorGotoLine(at + n - 1, 0);
+    editorSetStatusMessage("%d lines moved", n);
+}
+
+/*** yank registers ***/
+
+/*
+ * y yanks the cursor line, or the closed fold it is on, d deletes it into
+ * the unnamed register and p puts that after it. :[range]y [x],
+ * :[range]d [x] and :[line]pu [x] do the same for any range and register
+ * a to z. No text gets copied: a register holds
+ * erow structs sharing chars with the buffer, refs counts the holders, and
+ * a shared row only copies its text when it is about to change
+ * (editorRowOwn()). Yanking or putting a 500 MB region costs a few words
+ * per line, not 500 MB.
+ */
+
+void editorRegisterClear(struct yankRegister *r) {
+    int i;
+
+    for (i = 0; i < r->len; i++) editorFreeRow(&r->lines[i]);
+    free(r->lines);
+    r->lines = NULL;
+    r->len = 0;
+}
+
+void editorRegisterSet(struct yankRegister *r, erow *rows, int n) {
+    int i;
+
+    editorRegisterClear(r);
+    r->lines = malloc(sizeof(erow) * n);
+    if (r->lines == NULL) die("malloc");
+    for (i = 0; i < n; i++) r->lines[i] = editorRowShare(&rows[i]);
+    r->len = n;
+}
+
+/*
+ * Yank lines start..end into register reg, 0 being the unnamed one. As in
+ * vi, the unnamed register gets them too.
+ */
+void editorYank(int reg, int start, int end) {
+    editorRegisterSet(&E.regs[reg], &E.row[start], end - start + 1);
+    if (reg != 0) editorRegisterSet(&E.regs[0], E.regs[reg].lines, E.regs[reg].len);
+    editorSetStatusMessage("%d lines yanked", end - start + 1);
+}
+
+/*
+ * Delete lines start..end into register reg, and the unnamed one, as one
+ * edit. The rows move into the register as they are: no text is copied,
+ * freed or scanned. When most of the buffer goes, like deleting to the end
+ * of a 30M line file, the register takes the row array itself and the few
+ * rows that stay get a new one, so the big side doesn't move to fresh
+ * memory.
+ */
+void editorDeleteLines(int reg, int start, int end) {
+    struct yankRegister *r = &E.regs[reg];
+    int n = end - start + 1, kept = E.numrows - n, i;
+    erow *rows;
+
+    editorLspReplaceLines(start, end, "", 0, 0);
+    editorRegisterClear(r);
+    if (n > kept) {
+        rows = malloc(sizeof(erow) * (kept ? kept : 1));
+        if (rows == NULL) die("malloc");
+        memcpy(rows, E.row, sizeof(erow) * start);
+        memcpy(&rows[start], &E.row[end + 1], sizeof(erow) * (E.numrows - end - 1));
+        memmove(E.row, &E.row[start], sizeof(erow) * n);
+        r->lines = E.row;
+        E.row = rows;
+        E.rowcap = kept ? kept : 1;
+    } else {
+        r->lines = malloc(sizeof(erow) * n);
+        if (r->lines == NULL) die("malloc");
+        memcpy(r->lines, &E.row[start], sizeof(erow) * n);
+        memmove(&E.row[start], &E.row[end + 1], sizeof(erow) * (E.numrows - end - 1));
+    }
+    r->len = n;
+    for (i = 0; i < n; i++) editorRowWillChange(&r->lines[i]);
+    E.numrows = kept;
+    if (reg != 0) editorRegisterSet(&E.regs[0], r->lines, n);
+    editorLinesReplaced(start, end, 0);
+    editorGotoLine(start < E.numrows ? start : E.numrows - 1, 0);
+    editorSetStatusMessage("%d lines deleted", n);
+}
+
+/*
+ * Insert the lines of register reg before line at, as one edit.
+ */
+void editorPut(int reg, int at) {
+    struct yankRegister *r = &E.regs[reg];
+    int n = r->len, i;
+
+    if (n == 0) {
+        editorSetStatusMessage("Nothing in register %c", reg ? 'a' + reg - 1 : '"');
+        return;
+    }
+    if (E.lsp.opened) {
+        struct abuf ab = ABUF_INIT;
+        if (at == E.numrows && at > 0) abAppend(&ab, "\n", 1);
+        for (i = 0; i < n; i++) {
+            abAppend(&ab, r->lines[i].chars, r->lines[i].size);
+            if (i < n - 1 || at < E.numrows) abAppend(&ab, "\n", 1);
+        }
+        if (at < E.numrows)
+            editorLspChange(at, 0, at, 0, ab.b, ab.len);
+        else if (at > 0)
+            editorLspChange(at - 1, E.row[at - 1].size, at - 1, E.row[at - 1].size, ab.b, ab.len);
+        else
+            editorLspChange(0, 0, 0, 0, ab.b, ab.len);
+        abFree(&ab);
+    }
+
+    if (E.numrows + n > E.rowcap) {
+        while (E.numrows + n > E.rowcap) E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+        if (E.row == NULL) die("realloc");
+    }
+    memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+    for (i = 0; i < n; i++) {
+        E.row[at + i] = editorRowShare(&r->lines[i]);
+        editorWordsRowAdded(&E.row[at + i]);
+        editorStatsRow(&E.row[at + i], 1);  // the counts came along with the row
+    }
+    E.numrows += n;
+    editorLinesReplaced(at, at - 1, n);
+    editorGotoLine(at, 0);
+    editorSetStatusMessage("%d lines put", n);
+}
+
+void editorYankKey(int c) {
+    int start, end, fold;
+
+    if (c != 'y' && (E.pipe.pid > 0 || E.view.active)) return;
+    if (E.cy >= editorVisibleRows()) {
+        if (c == 'p' && E.numrows == 0) editorPut(0, 0);
+        return;
+    }
+    start = end = editorRowToLine(E.cy);
+    if (!E.view.active && (fold = editorFoldAt(start)) != -1) end = fold;
+    if (c == 'y')
+        editorYank(0, start, end);
+    else if (c == 'd')
+        editorDeleteLines(0, start, end);
+    else
+        editorPut(0, end + 1);
+}
+
+/*** pipe through command ***/
+
+/*
+ * ! pipes the whole buffer, or the closed fold under the cursor, through a
+ * shell command and puts the output in its place, like vi's !. The editor
+ * stays usable while the command runs: editorWaitKey() feeds it with
+ * writev() straight out of the rows and reads what comes back, as much as
+ * the pipes take each time, so nothing is joined into one big copy first.
+ * The output replaces the lines as one edit once the command exits with
+ * status 0. Insert mode is off meanwhile so the lines being fed stay put.
+ */
+
+void editorPipeClose() {
+    if (E.pipe.to != -1) close(E.pipe.to);
+    if (E.pipe.from != -1) close(E.pipe.from);
+    free(E.pipe.buf);
+    memset(&E.pipe, 0, sizeof(E.pipe));
+}
+
+void editorPipeCancel() {
+    if (E.pipe.pid <= 0) return;
+    kill(E.pipe.pid, SIGTERM);
+    waitpid(E.pipe.pid, NULL, 0);
+    editorPipeClose();
+}
+
+int editorPipeStart(const char *cmd, int start, int end) {
+    int in[2], out[2];
+
+    if (pipe(in) == -1) return -1;
+    if (pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+    E.pipe.pid = fork();
+    if (E.pipe.pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        if (devnull != -1) dup2(devnull, STDERR_FILENO);
+        close(in[1]);
+        close(out[0]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (E.pipe.pid == -1) {
+        close(in[1]);
+        close(out[0]);
+        E.pipe.pid = 0;
+        return -1;
+    }
+    E.pipe.to = in[1];
+    E.pipe.from = out[0];
+    fcntl(E.pipe.to, F_SETFL, fcntl(E.pipe.to, F_GETFL) | O_NONBLOCK);
+    fcntl(E.pipe.from, F_SETFL, fcntl(E.pipe.from, F_GETFL) | O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);  // a command that stops reading early is not an error
+    E.pipe.start = E.pipe.line = start;
+    E.pipe.end = end;
+    E.pipe.off = 0;
+    return 0;
+}
+
+/*
+ * Write the next lines to the command, up to 32 of them per writev().
+ * Returns 0 once the pipe is full or everything has been written.
+ */
+int editorPipeWrite() {
+    static char newline[] = "\n";
+    struct iovec iov[64];
+    int n = 0, line, off;
+    ssize_t written;
+
+    for (line = E.pipe.line, off = E.pipe.off; n < 63 && line <= E.pipe.end; line++, off = 0) {
+        erow *row = &E.row[line];
+        if (off < row->size) {
+            iov[n].iov_base = row->chars + off;
+            iov[n++].iov_len = row->size - off;
+        }
+        iov[n].iov_base = newline;
+        iov[n++].iov_len = 1;
+    }
+    written = n ? writev(E.pipe.to, iov, n) : 0;
+    if (written == -1 && errno == EAGAIN) return 0;
+    if (written == -1 && errno == EINTR) return 1;  // try again
+    if (written <= 0) {  // all written, or the command quit reading
+        close(E.pipe.to);
+        E.pipe.to = -1;
+        return 0;
+    }
+    while (written > 0) {
+        int left = E.row[E.pipe.line].size + 1 - E.pipe.off;
+        if (written < left) {
+            E.pipe.off += written;
+            break;
+        }
+        written -= left;
+        E.pipe.line++;
+        E.pipe.off = 0;
+    }
+    return 1;
+}
+
+void editorPipeRead() {
+    ssize_t n;
+
+    while (1) {
+        if (E.pipe.cap - E.pipe.len < 65536) {
+            E.pipe.cap = E.pipe.cap ? E.pipe.cap * 2 : 65536 * 4;
+            E.pipe.buf = realloc(E.pipe.buf, E.pipe.cap);
+            if (E.pipe.buf == NULL) die("realloc");
+        }
+        n = read(E.pipe.from, E.pipe.buf + E.pipe.len, E.pipe.cap - E.pipe.len);
+        if (n > 0) {
+            E.pipe.len += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;  // interrupted by a signal, not the end of the output
+        if (n == 0 || errno != EAGAIN) {
+            close(E.pipe.from);
+            E.pipe.from = -1;
+        }
+        return;
+    }
+}
+
+/*
+ * Do whatever the pipes allow right now. When the command is done with
+ * both, collect it and put its output in place.
+ */
+void editorPipePoll() {
+    int status;
+
+    if (E.pipe.pid <= 0) return;
+    while (E.pipe.to != -1 && editorPipeWrite());
+    if (E.pipe.from != -1) editorPipeRead();
+    if (E.pipe.to != -1 || E.pipe.from != -1) return;
+
+    waitpid(E.pipe.pid, &status, 0);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        editorReplaceLines(E.pipe.start, E.pipe.end, E.pipe.buf, E.pipe.len);
+        editorGotoLine(E.pipe.start < E.numrows ? E.pipe.start : E.numrows - 1, 0);
+    } else {
+        editorSetStatusMessage("Command failed, buffer left as it was");
+    }
+    editorPipeClose();
+    editorRefreshScreen();
+}
+
+void editorPipe() {
+    int start, end;
+    char *cmd;
+
+    if (E.pipe.pid > 0 || E.view.active || E.numrows == 0) return;
+    editorTargetLines(&start, &end);
+    cmd = editorPrompt("Pipe through: %s", NULL);
+    if (cmd == NULL) return;
+    if (cmd[0] != '\0' && editorPipeStart(cmd, start, end) == -1)
+        editorSetStatusMessage("Can't run command: %s", strerror(errno));
+    free(cmd);
+}
+
+/*
+ * Wait until there is a key to read, serving the language server and a
+ * running pipe whenever their descriptors become ready in the meantime.
+ */
+void editorWaitKey() {
+    while (1) {
+        struct pollfd fds[5];
+        int n = 0;
+
+        editorLspPoll();
+        editorPipePoll();
+        fds[n].fd = STDIN_FILENO;
+        fds[n++].events = POLLIN;
+        if (E.lsp.pid > 0) {
+            fds[n].fd = E.lsp.from;
+            fds[n++].events = POLLIN;
+            if (E.lsp.sent < E.lsp.out.len) {
+                fds[n].fd = E.lsp.to;
+                fds[n++].events = POLLOUT;
+            }
+        }
+        if (E.pipe.pid > 0) {
+            fds[n].fd = E.pipe.to;  // poll() skips a -1
+            fds[n++].events = POLLOUT;
+            fds[n].fd = E.pipe.from;
+            fds[n++].events = POLLIN;
+        }
+        if (n == 1) return;  // nothing else to serve, read() waits by itself
+        if (poll(fds, n, -1) == -1 && errno != EINTR) die("poll");
+        if (fds[0].revents) return;
+    }
+}
+
+/*** line sorting ***/
+
+/*
+ * S sorts the lines of the buffer (or of the closed fold under the cursor)
+ * by their bytes, N by the number they start with, R reverses them and U
+ * drops repeated adjacent lines. All of it works on the erow structs,
+ * which are only pointers and lengths, so no line text gets copied: a
+ * bottom-up merge sort moves the references, and the result goes back
+ * into the row array in one piece.
+ */
+
+int editorCompareBytes(const erow *a, const erow *b) {
+    int r = memcmp(a->chars, b->chars, a->size < b->size ? a->size : b->size);
+    return r ? r : a->size - b->size;
+}
+
+void editorNumKey(const erow *row, struct numKey *k) {
+    const char *p = row->chars, *end = row->chars + row->size;
+
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    k->neg = p < end && *p == '-';
+    if (k->neg) p++;
+    while (p < end && *p == '0') p++;
+    for (k->digits = p; p < end && isdigit((unsigned char)*p); p++);
+    k->ilen = p - k->digits;
+    k->frac = p < end && *p == '.' ? ++p : p;
+    while (p < end && isdigit((unsigned char)*p)) p++;
+    k->flen = p - k->frac;
+    while (k->flen > 0 && k->frac[k->flen - 1] == '0') k->flen--;
+    if (k->ilen == 0 && k->flen == 0) k->neg = 0;  // -0 is 0
+}
+
+/*
+ * Like sort -n, but the numbers are compared digit by digit instead of
+ * as doubles, so 20 digit IDs still sort exactly. Lines that don't start
+ * with a number count as 0. Equal numbers fall back to the bytes.
+ */
+int editorCompareNumbers(const erow *a, const erow *b) {
+    struct numKey x, y;
+    int r;
+
+    editorNumKey(a, &x);
+    editorNumKey(b, &y);
+    if (x.neg != y.neg) return y.neg - x.neg;
+    r = x.ilen - y.ilen;
+    if (r == 0) r = memcmp(x.digits, y.digits, x.ilen);
+    if (r == 0) r = memcmp(x.frac, y.frac, x.flen < y.flen ? x.flen : y.flen);
+    if (r == 0) r = x.flen - y.flen;
+    if (r != 0) return x.neg ? -r : r;
+    return editorCompareBytes(a, b);
+}
+
+/*
+ * The sort key of a line squeezed into 64 bits, compared first so most
+ * comparisons never touch the line itself. Bytes: the first 8 of them.
+ * Numbers: the integer part offset around 2^63 so negatives sort below,
+ * with anything too big for that clamped to the end of its side. Equal
+ * keys only mean "look closer".
+ */
+uint64_t editorSortKey(const erow *row, int numeric) {
+    uint64_t key = 0, v = 0, top = (uint64_t)1 << 63;
+    struct numKey k;
+    int i;
+
+    if (!numeric) {
+        for (i = 0; i < 8; i++) key = key << 8 | (i < row->size ? (unsigned char)row->chars[i] : 0);
+        return key;
+    }
+    editorNumKey(row, &k);
+    if (k.ilen > 19) v = top;  // more than fits, and 19 digits can't overflow
+    for (i = 0; i < k.ilen && k.ilen <= 19; i++) v = v * 10 + (k.digits[i] - '0');
+    if (v > top - 1) v = top - 1;
+    return k.neg ? top - 1 - v : top + v;
+}
+
+/*
+ * Stable merge sort of n line references, tmp has room for n more. Runs
+ * of SORT_RUN are insertion sorted first, and two runs already in order
+ * are copied over without merging, so sorted input is cheap.
+ */
+int editorSortInOrder(const struct sortRef *x, const struct sortRef *y, int (*cmp)(const erow *, const erow *)) {
+    return x->key != y->key ? x->key < y->key : cmp(x->row, y->row) <= 0;
+}
+
+void editorMergeSort(struct sortRef *a, struct sortRef *tmp, int n, int (*cmp)(const erow *, const erow *)) {
+    struct sortRef *src = a, *dst = tmp, *swap;
+    int width, lo, i, j, k;
+
+    for (lo = 0; lo < n; lo += SORT_RUN) {
+        int hi = lo + SORT_RUN < n ? lo + SORT_RUN : n;
+        for (i = lo + 1; i < hi; i++) {
+            struct sortRef r = a[i];
+            for (j = i; j > lo && !editorSortInOrder(&a[j - 1], &r, cmp); j--) a[j] = a[j - 1];
+            a[j] = r;
+        }
+    }
+    for (width = SORT_RUN; width < n; width *= 2) {
+        for (lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            if (mid == hi || editorSortInOrder(&src[mid - 1], &src[mid], cmp)) {
+                memcpy(&dst[lo], &src[lo], sizeof(*src) * (hi - lo));
+                continue;
+            }
+            for (i = lo, j = mid, k = lo; k < hi; k++)
+                dst[k] = (j == hi || (i < mid && editorSortInOrder(&src[i], &src[j], cmp))) ? src[i++] : src[j++];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != a) memcpy(a, src, sizeof(*src) * n);
+}
+
+/*
+ * Rearrange lines start..end as one edit, as flags (enum sortFlags) say:
+ * the order is settled first, sorted and/or reversed, and repeats are
+ * dropped while the lines are copied out in that order. With SORT_NUMERIC
+ * lines only compare equal when their bytes do, so repeats are the same
+ * either way.
+ */
+void editorSortRange(int start, int end, int flags) {
+    int (*cmp)(const erow *, const erow *) = flags & SORT_NUMERIC ? editorCompareNumbers : editorCompareBytes;
+    struct sortRef *refs = NULL;
+    int n, kept, i;
+    erow *lines, *row;
+
+    n = end - start + 1;
+    lines = malloc(sizeof(erow) * n);
+    if (lines == NULL) die("malloc");
+
+    if (flags & SORT_LINES) {
+        refs = malloc(sizeof(*refs) * n * 2);
+        if (refs == NULL) die("malloc");
+        for (i = 0; i < n; i++) {
+            refs[i].key = editorSortKey(&E.row[start + i], flags & SORT_NUMERIC);
+            refs[i].row = &E.row[start + i];
+        }
+        editorMergeSort(refs, refs + n, n, cmp);
+    }
+    for (i = kept = 0; i < n; i++) {
+        int from = flags & SORT_REVERSE ? n - 1 - i : i;
+        row = refs ? refs[from].row : &E.row[start + from];
+        if ((flags & SORT_UNIQUE) && kept > 0 && cmp(&lines[kept - 1], row) == 0) {
+            editorRowWillChange(row);
+            editorFreeRow(row);
+        } else {
+            lines[kept++] = *row;
+        }
+    }
+    free(refs);
+
+    if (E.lsp.opened) {
+        struct abuf ab = ABUF_INIT;
+        for (i = 0; i < kept; i++) {
+            abAppend(&ab, lines[i].chars, lines[i].size);
+            abAppend(&ab, "\n", 1);
+        }
+        editorLspReplaceLines(start, end, ab.b, ab.len, kept);
+        abFree(&ab);
+    }
+    memcpy(&E.row[start], lines, sizeof(erow) * kept);
+    memmove(&E.row[start + kept], &E.row[end + 1], sizeof(erow) * (E.numrows - end - 1));
+    E.numrows -= n - kept;
+    free(lines);
+    if (flags & SORT_UNIQUE) editorSetStatusMessage("%d duplicate lines removed", n - kept);
+    editorLinesReplaced(start, end, kept);
+    editorGotoLine(start, 0);
+}
+
+/*
+ * There is no undo, so the keys ask before they touch anything.
+ * :sort with a range doesn't.
+ */
+void editorSortLines(int key) {
+    const char *what = key == 'S' ? "Sort" : key == 'N' ? "Sort by number" : key == 'R' ? "Reverse" : "Dedup";
+    int flags = key == 'S'   ? SORT_LINES
+                : key == 'N' ? SORT_LINES | SORT_NUMERIC
+                : key == 'R' ? SORT_REVERSE
+                             : SORT_UNIQUE;
+    char prompt[64], *answer;
+    int start, end, yes;
+
+    if (E.pipe.pid > 0 || E.view.active || E.numrows == 0) return;
+    editorTargetLines(&start, &end);
+    snprintf(prompt, sizeof(prompt), "%s %d lines? (y/n) %%s", what, end - start + 1);
+    answer = editorPrompt(prompt, NULL);
+    yes = answer && (answer[0] == 'y' || answer[0] == 'Y');
+    free(answer);
+    if (yes) editorSortRange(start, end, flags);
+}
+
+/*** file i/o ***/
+
+/*
+ * Make filename the file of the buffer and read its lines from fp, or
+ * start it empty if fp is NULL: a new file, it gets created on save.
+ */
+void editorLoad(char *filename, FILE *fp) {
+    free(E.filename);
+    E.filename = strdup(filename);
+    if (!fp) return;
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
+        editorInsertRow(E.numrows, line, linelen);
+    }
+    free(line);
+    fclose(fp);
+    E.dirty = 0;
+    editorLspOpenDocument();
+}
+
+void editorOpen(char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp && errno != ENOENT) die("fopen");
+    editorLoad(filename, fp);
+}
+
+/*
+ * Throw away the current buffer and everything built on top of it.
+ */
+void editorFreeBuffer() {
+    int i;
+
+    for (i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
+    E.numrows = 0;
+    E.cx = E.cy = E.rowoff = E.coloff = 0;
+    editorViewClose();
+    E.cy = 0;
+    editorFoldFree(E.folds.root);
+    E.folds.root = 0;
+    E.brackets.valid = 0;
+    E.minimap.valid = 0;
+    E.diff.mapped = 0;
+    for (i = 0; i < E.words.len; i++) free(E.words.w[i].word);
+    E.words.len = 0;
+    E.words.built = 0;
+    E.stats.words = E.stats.chars = E.stats.bytes = 0;
+    editorDiffClose();
+    editorPipeCancel();
+    editorLspCloseDocument();
+    E.dirty = 0;
+}
+
+/*
+ * Open filename in place of the current buffer, asking first if that
+ * would lose unsaved changes. A file that can't be read leaves the
+ * current buffer as it is.
+ */
+void editorOpenReplace(char *filename) {
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp && errno != ENOENT) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        return;
+    }
+    if (E.dirty) {
+        char *answer = editorPrompt("Discard unsaved changes? (y/n) %s", NULL);
+        int yes = answer && (answer[0] == 'y' || answer[0] == 'Y');
+        free(answer);
+        if (!yes) {
+            if (fp) fclose(fp);
+            return;
+        }
+    }
+    editorFreeBuffer();
+    editorLoad(filename, fp);
+}
+
+/*
+ * Write every row followed by '\n'. stdio does the buffering, so there is no
+ * need to join the whole file into one big string first.
+ */
+void editorSave() {
+    int j;
+
+    if (E.filename == NULL) {
+        E.filename = editorPrompt("Save as: %s", NULL);
+        if (E.filename == NULL) return;
+        if (E.filename[0] == '\0') {
+            free(E.filename);
+            E.filename = NULL;
+            return;
+        }
+    }
+
+    FILE *fp = fopen(E.filename, "w");
+    if (!fp) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+    for (j = 0; j < E.numrows; j++) {
+        fwrite(E.row[j].chars, 1, E.row[j].size, fp);
+        fputc('\n', fp);
+    }
+    if (fclose(fp) == 0) {
+        E.dirty = 0;
+        editorDiffSaved();
+        editorSetStatusMessage("%lld bytes written to disk", E.stats.bytes + E.numrows);
+    } else {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    }
+}
+
+/*** ex commands ***/
+
+/*
+ * : reads a command line, like vi's:
+ *   :N                       go to line N
+ *   :[range]s/pat/text/[g]   replace pat with text, every one with g
+ *   :[range]g/pat/d          delete the lines containing pat
+ *   :[range]v/pat/d          delete the lines without it
+ *   :[range]>  :[range]<     indent by a tab, or take one off (>> for two)
+ *   :[range]sort[!] [n] [u]  sort, backwards, by number, dropping repeats
+ *   :[range]y [x]            yank into register x, see editorYank()
+ *   :[range]d [x]            delete into register x
+ *   :[range]m N              move below line N, 0 for the top
+ *   :[line]pu [x]            put register x after line, 0 for the top
+ *   :w                       save
+ * A range is %, N or N,M where N is a line number, . for the cursor line
+ * or $ for the last one, plus or minus an offset. Without one, s, >, <, y,
+ * d, m and pu work on the cursor line and g, v and sort on the lines editorTargetLines()
+ * picks. Patterns are plain strings, as in the filter, and \ before the
+ * delimiter makes it part of the pattern.
+ *
+ * Each command goes over its lines once and lands as a single edit: one
+ * move of the rows, one change for the language server and one redraw,
+ * so :g/x/d on millions of lines is not millions of deletes.
+ */
+
+/*
+ * Parse the address at *p into a line index. Returns 0 if there is none.
+ */
+int editorExAddress(char **p, int cur, int *line) {
+    char *s = *p;
+
+    if (isdigit((unsigned char)*s)) {
+        *line = strtol(s, &s, 10) - 1;
+    } else if (*s == '.' || *s == '$') {
+        *line = *s++ == '.' ? cur : E.numrows - 1;
+    } else if (*s == '+' || *s == '-') {
+        *line = cur;
+    } else {
+        return 0;
+    }
+    while (*s == '+' || *s == '-') {
+        int sign = *s++ == '+' ? 1 : -1;
+        *line += sign * (isdigit((unsigned char)*s) ? (int)strtol(s, &s, 10) : 1);
+    }
+    *p = s;
+    return 1;
+}
+
+/*
+ * Cut *p at the next delim not preceded by a backslash, dropping the
+ * backslashes of escaped ones. Returns the part before it and leaves *p
+ * just after it, or at the end of the string if there is none.
+ */
+char *editorExPart(char **p, char delim) {
+    char *start = *p, *r = *p, *w = *p;
+
+    while (*r && *r != delim) {
+        if (r[0] == '\\' && r[1] == delim) r++;
+        *w++ = *r++;
+    }
+    *p = *r ? r + 1 : r;
+    *w = '\0';
+    return start;
+}
+
+/*
+ * Append row with pat replaced by text, only the first one unless all.
+ * Returns how many were replaced, with ab left alone when that is 0.
+ */
+int editorExSubstituteRow(struct abuf *ab, erow *row, const char *pat, const char *text, int all) {
+    size_t patlen = strlen(pat), textlen = strlen(text);
+    char *p = row->chars, *stop = row->chars + row->size, *m;
+    int count = 0;
+
+    while ((count == 0 || all) && (m = memmem(p, stop - p, pat, patlen)) != NULL) {
+        abAppend(ab, p, m - p);
+        abAppend(ab, text, textlen);
+        p = m + patlen;
+        count++;
+    }
+    if (count) abAppend(ab, p, stop - p);
+    return count;
+}
+
+/*
+ * The number of lines stays the same, so the rows that match are rewritten
+ * where they are and the rest aren't touched. The language server gets the
+ * lines from the first to the last one that changed, as one change.
+ */
+void editorExSubstitute(int start, int end, const char *pat, const char *text, int all) {
+    struct abuf ab = ABUF_INIT;
+    int first = -1, last = -1, lines = 0, count = 0, n, i, j;
+
+    if (E.lsp.opened) {
+        for (i = start; i <= end; i++) {
+            if (memmem(E.row[i].chars, E.row[i].size, pat, strlen(pat)) == NULL) continue;
+            if (first == -1) first = last = i;
+            for (j = last + 1; j < i; j++) {
+                abAppend(&ab, E.row[j].chars, E.row[j].size);
+                abAppend(&ab, "\n", 1);
+            }
+            editorExSubstituteRow(&ab, &E.row[i], pat, text, all);
+            abAppend(&ab, "\n", 1);
+            last = i;
+        }
+        if (first != -1) editorLspReplaceLines(first, last, ab.b, ab.len, last - first + 1);
+    }
+
+    for (i = start; i <= end; i++) {
+        erow *row = &E.row[i];
+        char *chars;
+        ab.len = 0;
+        if ((n = editorExSubstituteRow(&ab, row, pat, text, all)) == 0) continue;
+        editorRowWillChange(row);
+        editorRowOwn(row);
+        chars = realloc(row->chars, ab.len + 1);
+        if (chars == NULL) die("realloc");
+        row->chars = chars;
+        memcpy(row->chars, ab.b, ab.len);
+        row->size = ab.len;
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+        count += n;
+        lines++;
+        last = i;
+    }
+    abFree(&ab);
+    if (lines == 0) {
+        editorSetStatusMessage("Pattern not found: %s", pat);
+        return;
+    }
+    E.dirty++;
+    editorGotoLine(last, 0);
+    editorSetStatusMessage("%d substitutions on %d lines", count, lines);
+}
+
+/*
+ * Delete the lines of start..end that contain pat, or with invert the ones
+ * that don't. The kept rows slide down in place, no line is copied.
+ */
+void editorExGlobalDelete(int start, int end, const char *pat, int invert) {
+    size_t patlen = strlen(pat);
+    int n = end - start + 1, kept = 0, i;
+    char *del = malloc(n);
+
+    if (del == NULL) die("malloc");
+    for (i = 0; i < n; i++) {
+        del[i] = (memmem(E.row[start + i].chars, E.row[start + i].size, pat, patlen) != NULL) != invert;
+        kept += !del[i];
+    }
+    if (kept == n) {
+        free(del);
+        editorSetStatusMessage("Pattern not found: %s", pat);
+        return;
+    }
+
+    if (E.lsp.opened) {
+        struct abuf ab = ABUF_INIT;
+        for (i = 0; i < n; i++) {
+            if (del[i]) continue;
+            abAppend(&ab, E.row[start + i].chars, E.row[start + i].size);
+            abAppend(&ab, "\n", 1);
+        }
+        editorLspReplaceLines(start, end, ab.b, ab.len, kept);
+        abFree(&ab);
+    }
+    for (i = 0, kept = start; i < n; i++) {
+        if (del[i]) {
+            editorRowWillChange(&E.row[start + i]);
+            editorFreeRow(&E.row[start + i]);
+        } else {
+            E.row[kept++] = E.row[start + i];
+        }
+    }
+    free(del);
+    kept -= start;
+    memmove(&E.row[start + kept], &E.row[end + 1], sizeof(erow) * (E.numrows - end - 1));
+    E.numrows -= n - kept;
+    editorLinesReplaced(start, end, kept);
+    editorGotoLine(start < E.numrows ? start : E.numrows - 1, 0);
+    editorSetStatusMessage("%d lines deleted", n - kept);
+}
+
+/*
+ * Indent start..end by levels tabs, or take off -levels of indentation:
+ * a tab, or up to 8 spaces, each. Empty lines are left alone.
+ */
+void editorExShift(int start, int end, int levels) {
+    struct abuf ab = ABUF_INIT;
+    int i, j, k;
+
+    for (i = start; i <= end; i++) {
+        erow *row = &E.row[i];
+        int skip = 0;
+        if (levels > 0 && row->size > 0) {
+            for (j = 0; j < levels; j++) abAppend(&ab, "\t", 1);
+        }
+        for (j = 0; j < -levels && skip < row->size; j++) {
+            if (row->chars[skip] == '\t') {
+                skip++;
+                continue;
+            }
+            for (k = 0; k < 8 && skip < row->size && row->chars[skip] == ' '; k++) skip++;
+        }
+        abAppend(&ab, row->chars + skip, row->size - skip);
+        abAppend(&ab, "\n", 1);
+    }
+    editorReplaceLines(start, end, ab.b, ab.len);
+    abFree(&ab);
+    editorGotoLine(start, 0);
+}
+
+/*
+ * The register named after a command, 0 (unnamed) if there is none.
+ */
+int editorExRegister(const char *p) {
+    while (*p == ' ') p++;
+    return *p >= 'a' && *p <= 'z' ? *p - 'a' + 1 : 0;
+}
+
+/*
+ * Run one command line, as typed after the :.
+ */
+void editorExRun(char *cmd) {
+    char *p = cmd, *pat, delim;
+    int cur, start, end, ranged = 1, levels;
+
+    if (E.pipe.pid > 0 || E.view.active) {
+        editorSetStatusMessage("Not while piping or filtering");
+        return;
+    }
+    cur = E.cy < editorVisibleRows() ? editorRowToLine(E.cy) : 0;
+    while (*p == ' ') p++;
+    if (*p == '%') {
+        p++;
+        start = 0;
+        end = E.numrows - 1;
+    } else if (editorExAddress(&p, cur, &start)) {
+        end = start;
+        if (*p == ',' && (p++, !editorExAddress(&p, cur, &end))) {
+            editorSetStatusMessage("Missing address after ,");
+            return;
+        }
+    } else {
+        ranged = 0;
+        start = end = cur;
+    }
+    while (*p == ' ') p++;
+
+    if (*p == 'w' && p[1] == '\0') {
+        editorSave();
+        return;
+    }
+    if (strncmp(p, "pu", 2) == 0) {
+        if (E.numrows == 0) end = -1;  // an empty buffer has no line to put after
+        if (end < -1 || end >= E.numrows) {
+            editorSetStatusMessage("Range out of the buffer: 0..%d", E.numrows);
+            return;
+        }
+        editorPut(editorExRegister(p + 2), end + 1);
+        return;
+    }
+    if (E.numrows == 0) return;
+    if (!ranged && (*p == 'g' || *p == 'v' || strncmp(p, "sort", 4) == 0)) editorTargetLines(&start, &end);
+    if (start > end) {
+        int swap = start;
+        start = end;
+        end = swap;
+    }
+    if (start < 0 || end >= E.numrows) {
+        editorSetStatusMessage("Range out of the buffer: 1..%d", E.numrows);
+        return;
+    }
+
+    if (*p == '\0') {
+        editorGotoLine(end, 0);
+    } else if (strncmp(p, "sort", 4) == 0) {
+        int flags = SORT_LINES;
+        if (p[4] == '!') flags |= SORT_REVERSE;
+        if (strchr(p + 4, 'n')) flags |= SORT_NUMERIC;
+        if (strchr(p + 4, 'u')) flags |= SORT_UNIQUE;
+        editorSortRange(start, end, flags);
+    } else if ((*p == 's' || *p == 'g' || *p == 'v') && p[1] && !isalnum((unsigned char)p[1]) && p[1] != ' ') {
+        char c = *p;
+        delim = p[1];
+        p += 2;
+        pat = editorExPart(&p, delim);
+        if (*pat == '\0') {
+            editorSetStatusMessage("Empty pattern");
+        } else if (c == 's') {
+            char *text = editorExPart(&p, delim);
+            editorExSubstitute(start, end, pat, text, strchr(p, 'g') != NULL);
+        } else if (strcmp(p, "d") == 0) {
+            editorExGlobalDelete(start, end, pat, c == 'v');
+        } else {
+            editorSetStatusMessage("Only :%c/pattern/d is supported", c);
+        }
+    } else if ((*p == 'y' || *p == 'd') && (p[1] == '\0' || p[1] == ' ')) {
+        if (*p == 'y')
+            editorYank(editorExRegister(p + 1), start, end);
+        else
+            editorDeleteLines(editorExRegister(p + 1), start, end);
+    } else if (*p == 'm' && (p[1] == '\0' || p[1] == ' ' || !isalpha((unsigned char)p[1]))) {
+        int to;
+        for (p++; *p == ' '; p++);
+        if (!editorExAddress(&p, cur, &to) || to < -1 || to >= E.numrows)
+            editorSetStatusMessage("Move where? 0..%d", E.numrows);
+        else
+            editorMoveLines(start, end, to);
+    } else if (*p == '>' || *p == '<') {
+        for (levels = 0; *p == '>' || *p == '<'; p++) levels += *p == '>' ? 1 : -1;
+        if (levels) editorExShift(start, end, levels);
+    } else {
+        editorSetStatusMessage("Not an editor command: %s", p);
+    }
+}
+
+void editorExCommand() {
+    char *cmd = editorPrompt(":%s", NULL);
+    if (cmd == NULL) return;
+    editorExRun(cmd);
+    free(cmd);
+}
+
+/*** json view ***/
+
+/*
+ * Skip the rest of a JSON string, i being just after its opening quote.
+ * Returns the offset just past the closing quote. Strings are most of the
+ * bytes in a typical payload, so look for a quote or backslash 8 bytes at a
+ * time (the usual "has zero byte" trick on the XOR with each of them).
+ */
+int editorJsonSkipString(const char *s, int len, int i) {
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    const uint64_t quotes = ones * '"', slashes = ones * '\\';
+
+    while (i < len) {
+        while (i + 8 <= len) {
+            uint64_t w, q, b;
+            memcpy(&w, &s[i], 8);
+            q = w ^ quotes;
+            b = w ^ slashes;
+            if (((q - ones) & ~q & highs) | ((b - ones) & ~b & highs)) break;
+            i += 8;
+        }
+        if (i >= len) break;
+        if (s[i] == '\\')
+            i += 2;
+        else if (s[i] == '"')
+            return i + 1;
+        else
+            i++;
+    }
+    return len;
+}
+
+int editorJsonSkipSpace(const char *s, int len, int i) {
+    while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) i++;
+    return i;
+}
+
+/*
+ * Offset of the bracket closing the object/array whose opener is just before i.
+ */
+int editorJsonMatchClose(const char *s, int len, int i) {
+    int depth = 1;
+    while (i < len) {
+        char c = s[i];
+        if (c == '"') {
+            i = editorJsonSkipString(s, len, i + 1);
+            continue;
+        }
+        if (c == '{' || c == '[') depth++;
+        if ((c == '}' || c == ']') && --depth == 0) return i;
+        i++;
+    }
+    return len;
+}
+
+int editorJsonIsFolded(int start) {
+    int i;
+    for (i = 0; i < E.json.nfolds; i++)
+        if (E.json.folds[i] == start) return 1;
+    return 0;
+}
+
+/*
+ * Lay out one line starting at pos: it runs up to and including a ',' or an
+ * opening bracket, or up to (not including) a closing bracket, which then
+ * gets a line of its own. Empty {} and [] stay on the line they are on.
+ * With fold set, a line ending in an opening bracket swallows everything up
+ * to the matching close, whose offset goes into *foldend.
+ * Returns where the next line starts and its indentation in *nextdepth.
+ */
+int editorJsonLineEnd(const char *s, int len, int pos, int depth, int fold, int *nextdepth, int *foldend) {
+    int i = pos;
+
+    *nextdepth = depth;
+    *foldend = -1;
+    while (i < len) {
+        char c = s[i];
+        if (c == '"') {
+            i = editorJsonSkipString(s, len, i + 1);
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            int j = editorJsonSkipSpace(s, len, i + 1);
+            if (j < len && (s[j] == '}' || s[j] == ']')) {
+                i = j + 1;
+                continue;
+            }
+            if (!fold) {
+                *nextdepth = depth + 1;
+                i++;
+                break;
+            }
+            // folded: the line carries on after the matching close, e.g. "a": {...},
+            i = *foldend = editorJsonMatchClose(s, len, i + 1);
+            if (i < len) i++;
+            fold = 0;
+            continue;
+        }
+        if (c == '}' || c == ']') {
+            if (i > pos) break;
+            i++;
+            continue;
+        }
+        i++;
+        if (c == ',') break;
+    }
+
+    i = editorJsonSkipSpace(s, len, i);
+    if (i < len && (s[i] == '}' || s[i] == ']')) (*nextdepth)--;
+    return i;
+}
+
+/*
+ * Extend the layout until line upto exists (or the text runs out).
+ * Only this ever scans the JSON, so the cost is proportional to how far
+ * down the user went, not to the size of the document.
+ */
+void editorJsonLayout(int upto) {
+    erow *row = &E.row[E.json.line];
+
+    while (E.json.len <= upto && E.json.next < row->size) {
+        struct jsonLine *jl;
+        int start = E.json.next;
+        int depth = E.json.nextdepth;
+
+        if (E.json.len == E.json.cap) {
+            E.json.cap = E.json.cap ? E.json.cap * 2 : 1024;
+            E.json.lines = realloc(E.json.lines, sizeof(struct jsonLine) * E.json.cap);
+            if (E.json.lines == NULL) die("realloc");
+        }
+        jl = &E.json.lines[E.json.len++];
+        jl->start = start;
+        jl->depth = depth < 0 ? 0 : depth;
+        E.json.next = editorJsonLineEnd(row->chars, row->size, start, depth, editorJsonIsFolded(start),
+                                        &E.json.nextdepth, &jl->foldend);
+    }
+}
+
+void editorJsonOpen() {
+    if (E.view.active || E.cy >= editorVisibleRows()) return;
+    if (E.pipe.pid > 0) {  // its output would replace the row under the view
+        editorSetStatusMessage("Wait for the command to finish");
+        return;
+    }
+
+    E.json.active = 1;
+    E.json.line = editorRowToLine(E.cy);
+    E.json.len = 0;
+    E.json.next = editorJsonSkipSpace(E.row[E.json.line].chars, E.row[E.json.line].size, 0);
+    E.json.nextdepth = 0;
+    E.json.nfolds = 0;
+    E.cy = E.cx = E.rowoff = E.coloff = 0;
+    editorJsonLayout(E.screenrows);
+}
+
+/*
+ * Back to the file, with the cursor on the JSON row at the start of the
+ * element that was under the cursor.
+ */
+void editorJsonClose() {
+    E.cx = E.cy < E.json.len ? E.json.lines[E.cy].start : 0;
+    E.cy = editorFoldLineToRow(E.json.line);
+    E.rowoff = 0;
+    E.json.active = 0;
+    E.json.len = 0;
+    free(E.json.folds);
+    E.json.folds = NULL;
+    E.json.nfolds = 0;
+}
+
+/*
+ * Fold or unfold the object/array opened at the end of the cursor line.
+ * Everything below the cursor gets laid out again.
+ */
+void editorJsonToggleFold() {
+    erow *row = &E.row[E.json.line];
+    struct jsonLine *jl;
+    int i, nextdepth, foldend;
+
+    if (E.cy >= E.json.len) return;
+    jl = &E.json.lines[E.cy];
+
+    if (editorJsonIsFolded(jl->start)) {
+        for (i = 0; i < E.json.nfolds; i++)
+            if (E.json.folds[i] == jl->start) E.json.folds[i] = E.json.folds[--E.json.nfolds];
+    } else {
+        editorJsonLineEnd(row->chars, row->size, jl->start, jl->depth, 1, &nextdepth, &foldend);
+        if (foldend == -1) return;  // nothing to fold on this line
+        E.json.folds = realloc(E.json.folds, sizeof(int) * (E.json.nfolds + 1));
+        if (E.json.folds == NULL) die("realloc");
+        E.json.folds[E.json.nfolds++] = jl->start;
+    }
+
+    E.json.next = jl->start;
+    E.json.nextdepth = jl->depth;
+    E.json.len = E.cy;
+    editorJsonLayout(E.rowoff + E.screenrows);
+}
+
+/*
+ * Copy s[from..to) into line the way it is displayed: whitespace outside of
+ * strings dropped, a space after each ':'. from is never inside a string.
+ */
+int editorJsonRender(const char *s, int from, int to, char *line, int col, int maxcol) {
+    int instr = 0, i;
+    for (i = from; i < to && col < maxcol; i++) {
+        char c = s[i];
+        if (instr) {
+            if (c == '\\' && i + 1 < to) {
+                line[col++] = c;
+                if (col < maxcol) line[col++] = s[++i];
+                continue;
+            }
+            if (c == '"') instr = 0;
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            continue;
+        } else if (c == '"') {
+            instr = 1;
+        }
+        line[col++] = iscntrl((unsigned char)c) ? '?' : c;
+        if (!instr && c == ':' && col < maxcol) line[col++] = ' ';
+    }
+    return col;
+}
+
+void editorJsonDrawLine(struct abuf *ab, int vrow) {
+    erow *row = &E.row[E.json.line];
+    struct jsonLine *jl = &E.json.lines[vrow];
+    int end = vrow + 1 < E.json.len ? E.json.lines[vrow + 1].start : E.json.next;
+    char *line = E.json.text;
+    int col = 0, nextdepth, foldend;
+
+    while (col < jl->depth * 2 && col < E.screencols) line[col++] = ' ';
+    if (jl->foldend == -1) {
+        col = editorJsonRender(row->chars, jl->start, end, line, col, E.screencols);
+    } else {
+        // up to and including the opening bracket, a marker, then from the close on
+        int open = editorJsonLineEnd(row->chars, row->size, jl->start, jl->depth, 0, &nextdepth, &foldend);
+        col = editorJsonRender(row->chars, jl->start, open, line, col, E.screencols);
+        col = editorJsonRender("...", 0, 3, line, col, E.screencols);
+        col = editorJsonRender(row->chars, jl->foldend, end, line, col, E.screencols);
+    }
+    abAppend(ab, line, col);
+}
+
+void editorJsonProcessKey(int c) {
+    int times;
+
+    switch (c) {
+        case CTRL_KEY('q'):
+            write(STDOUT_FILENO, "\x1b[2J", 4);
+            write(STDOUT_FILENO, "\x1b[H", 3);
+            exit(0);
+            break;
+
+        case '\x1b':
+            editorJsonClose();
+            return;
+
+        case 'z':
+            editorJsonToggleFold();
+            break;
+
+        case 'j':
+        case ARROW_UP:
+            if (E.cy > 0) E.cy--;
+            break;
+
+        case 'k':
+        case ARROW_DOWN:
+            editorJsonLayout(E.cy + 1);
+            if (E.cy < E.json.len - 1) E.cy++;
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN:
+            times = E.screenrows;
+            editorJsonLayout(E.cy + times);
+            while (times--) {
+                if (c == PAGE_UP && E.cy > 0) E.cy--;
+                if (c == PAGE_DOWN && E.cy < E.json.len - 1) E.cy++;
+            }
+            break;
+
+        case 'g':
+            E.cy = 0;
+            break;
+
+        case 'G':
+            editorJsonLayout(INT_MAX - 1);
+            E.cy = E.json.len ? E.json.len - 1 : 0;
+            break;
+    }
+
+    // the rows about to be drawn must be laid out
+    editorJsonLayout(E.cy + E.screenrows);
+    E.cx = E.cy < E.json.len ? E.json.lines[E.cy].depth * 2 : 0;
+    if (E.cx >= E.screencols) E.cx = E.screencols - 1;
+}
+
+/*** file picker ***/
+
+/*
+ * Ctrl-P lists every file under the current directory and narrows it down
+ * as a fuzzy match on what is typed. The listing is walked once and kept
+ * for the rest of the session: all paths in one arena, plus a 64 bit mask
+ * per path of which characters it contains. A path whose mask lacks a
+ * character of the query can't match, so most of the list is rejected
+ * with one AND before the real match is even tried.
+ */
+
+uint64_t editorCharMask(const char *s) {
+    uint64_t mask = 0;
+    for (; *s; s++) {
+        int c = tolower((unsigned char)*s);
+        if (c >= 'a' && c <= 'z')
+            mask |= 1ULL << (c - 'a');
+        else if (c >= '0' && c <= '9')
+            mask |= 1ULL << (26 + c - '0');
+        else
+            mask |= 1ULL << (36 + c % 28);
+    }
+    return mask;
+}
+
+/*
+ * Read the patterns of ./.gitignore. Negations (!) are not supported and skipped.
+ */
+void editorFilesLoadIgnore() {
+    FILE *fp = fopen(".gitignore", "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+
+    if (!fp) return;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && isspace((unsigned char)line[linelen - 1])) line[--linelen] = '\0';
+        if (linelen == 0 || line[0] == '#' || line[0] == '!') continue;
+        E.files.ignore = realloc(E.files.ignore, sizeof(char *) * (E.files.nignore + 1));
+        if (E.files.ignore == NULL) die("realloc");
+        E.files.ignore[E.files.nignore++] = strdup(line[0] == '/' ? line + 1 : line);
+    }
+    free(line);
+    fclose(fp);
+}
+
+int editorFilesIgnored(const char *path, const char *name, int isdir) {
+    int i;
+    if (strcmp(name, ".git") == 0) return 1;
+    for (i = 0; i < E.files.nignore; i++) {
+        char pat[PATH_MAX];
+        int len = snprintf(pat, sizeof(pat), "%s", E.files.ignore[i]);
+        if (len > 0 && pat[len - 1] == '/') {
+            if (!isdir) continue;
+            pat[--len] = '\0';
+        }
+        if (strchr(pat, '/') ? fnmatch(pat, path, FNM_PATHNAME) == 0 : fnmatch(pat, name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+void editorFilesAdd(const char *path) {
+    size_t len = strlen(path) + 1;
+
+    while (E.files.used + len > E.files.arenacap) {
+        E.files.arenacap = E.files.arenacap ? E.files.arenacap * 2 : 65536;
+        E.files.arena = realloc(E.files.arena, E.files.arenacap);
+        if (E.files.arena == NULL) die("realloc");
+    }
+    if (E.files.n == E.files.cap) {
+        E.files.cap = E.files.cap ? E.files.cap * 2 : 1024;
+        E.files.off = realloc(E.files.off, sizeof(size_t) * E.files.cap);
+        E.files.mask = realloc(E.files.mask, sizeof(uint64_t) * E.files.cap);
+        if (E.files.off == NULL || E.files.mask == NULL) die("realloc");
+    }
+    memcpy(&E.files.arena[E.files.used], path, len);
+    E.files.off[E.files.n] = E.files.used;
+    E.files.mask[E.files.n] = editorCharMask(path);
+    E.files.n++;
+    E.files.used += len;
+}
+
+/*
+ * Walk dir (relative to the current directory, "" for the top). readdir()'s
+ * d_type saves a stat() per entry where the filesystem fills it in.
+ */
+void editorFilesWalk(const char *dir) {
+    DIR *d = opendir(*dir ? dir : ".");
+    struct dirent *de;
+
+    if (d == NULL) return;
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        int isdir;
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        if (snprintf(path, sizeof(path), "%s%s%s", dir, *dir ? "/" : "", de->d_name) >= (int)sizeof(path)) continue;
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) == -1) continue;
+            isdir = S_ISDIR(st.st_mode);
+        } else {
+            isdir = de->d_type == DT_DIR;
+        }
+        if (editorFilesIgnored(path, de->d_name, isdir)) continue;
+        if (isdir)
+            editorFilesWalk(path);
+        else
+            editorFilesAdd(path);
+    }
+    closedir(d);
+}
+
+/*
+ * Score path as a match for query: every query character has to appear in
+ * order (case insensitive). Runs of consecutive characters, matches at the
+ * start of a path component or word, and matches in the file name score
+ * higher, long paths a little lower. -1 if it doesn't match at all.
+ * Any match scores 0 or more.
+ */
+int editorFuzzyScore(const char *path, const char *query) {
+    const char *base = strrchr(path, '/');
+    int score = 0, prev = -2, i;
+
+    base = base ? base + 1 : path;
+    for (i = 0; path[i] && *query; i++) {
+        if (tolower((unsigned char)path[i]) != tolower((unsigned char)*query)) continue;
+        score++;
+        if (i == prev + 1) score += 5;
+        if (i == 0 || strchr("/_-. ", path[i - 1])) score += 8;
+        if (&path[i] >= base) score += 2;
+        prev = i;
+        query++;
+    }
+    if (*query) return -1;
+    while (path[i]) i++;
+    return score + (PATH_MAX - i) / 8;
+}
+
+/*
+ * Recompute the results for query. When the query only grew, the paths
+ * matching it are a subset of the previous matches, so just those are
+ * looked at again.
+ */
+void editorPickerUpdate(const char *query) {
+    uint64_t qmask = editorCharMask(query);
+    int narrowing = E.picker.query && strncmp(query, E.picker.query, strlen(E.picker.query)) == 0;
+    int n = narrowing ? E.picker.nmatches : E.files.n;
+    int i, kept = 0, max = E.screenrows > 0 ? E.screenrows : 1;
+
+    if (E.picker.matches == NULL) E.picker.matches = malloc(sizeof(int) * (E.files.n + 1));
+    if (E.picker.scores == NULL) E.picker.scores = malloc(sizeof(int) * (E.screenrows + 1));
+    if (E.picker.results == NULL) E.picker.results = malloc(sizeof(int) * (E.screenrows + 1));
+    E.picker.nresults = 0;
+
+    for (i = 0; i < n; i++) {
+        int f = narrowing ? E.picker.matches[i] : i;
+        int score, j;
+        if (qmask & ~E.files.mask[f]) continue;
+        score = editorFuzzyScore(&E.files.arena[E.files.off[f]], query);
+        if (score < 0) continue;
+        E.picker.matches[kept++] = f;
+
+        // keep the best max results sorted by score
+        if (E.picker.nresults == max && score <= E.picker.scores[max - 1]) continue;
+        j = E.picker.nresults < max ? E.picker.nresults++ : max - 1;
+        while (j > 0 && E.picker.scores[j - 1] < score) {
+            E.picker.scores[j] = E.picker.scores[j - 1];
+            E.picker.results[j] = E.picker.results[j - 1];
+            j--;
+        }
+        E.picker.scores[j] = score;
+        E.picker.results[j] = f;
+    }
+    E.picker.nmatches = kept;
+    free(E.picker.query);
+    E.picker.query = strdup(query);
+    E.picker.sel = 0;
+}
+
+void editorPickerCallback(char *query, int key) {
+    if (key == ARROW_UP && E.picker.sel > 0)
+        E.picker.sel--;
+    else if (key == ARROW_DOWN && E.picker.sel < E.picker.nresults - 1)
+        E.picker.sel++;
+    else if (key != '\r' && key != '\x1b' && strcmp(query, E.picker.query) != 0)
+        editorPickerUpdate(query);
+}
+
+/*
+ * Result row y of the picker, the selected one in inverse video.
+ */
+void editorPickerDrawRow(struct abuf *ab, int y) {
+    const char *path;
+    int len;
+
+    if (y >= E.picker.nresults) {
+        abAppend(ab, "~", 1);
+        return;
+    }
+    path = &E.files.arena[E.files.off[E.picker.results[y]]];
+    len = strlen(path);
+    if (len > E.screencols) len = E.screencols;
+    if (y == E.picker.sel) abAppend(ab, "\x1b[7m", 4);
+    editorDrawText(ab, path, len);
+    if (y == E.picker.sel) abAppend(ab, "\x1b[m", 3);
+}
+
+void editorPickFile() {
+    char *query, *path;
+
+    if (!E.files.built) {
+        editorFilesLoadIgnore();
+        editorFilesWalk("");
+        E.files.built = 1;
+    }
+
+    free(E.picker.query);
+    E.picker.query = NULL;
+    editorPickerUpdate("");
+    E.picker.active = 1;
+    query = editorPrompt("Open: %s", editorPickerCallback);
+    E.picker.active = 0;
+    if (query == NULL) return;
+    free(query);
+    if (E.picker.nresults == 0) return;
+
+    path = strdup(&E.files.arena[E.files.off[E.picker.results[E.picker.sel]]]);
+    editorOpenReplace(path);
+    free(path);
+}
+
+/*** project search ***/
+
+/*
+ * Ctrl-G searches every file of the picker's listing for a string and
+ * shows the hits as a list: path:line: text. Each file is mmap'd and
+ * searched with memmem(), lines are only counted up to the hits.
+ * The list is redrawn every GREP_REFRESH files, so the first hits show up
+ * while the rest of the tree is still being searched.
+ */
+
+void editorGrepAdd(int file, int line, int col, const char *text, int len) {
+    struct grepResult *r;
+
+    if (len > GREP_TEXT_MAX) len = GREP_TEXT_MAX;
+    if (E.grep.n == E.grep.cap) {
+        E.grep.cap = E.grep.cap ? E.grep.cap * 2 : 256;
+        E.grep.r = realloc(E.grep.r, sizeof(struct grepResult) * E.grep.cap);
+        if (E.grep.r == NULL) die("realloc");
+    }
+    while (E.grep.used + len + 1 > E.grep.arenacap) {
+        E.grep.arenacap = E.grep.arenacap ? E.grep.arenacap * 2 : 65536;
+        E.grep.arena = realloc(E.grep.arena, E.grep.arenacap);
+        if (E.grep.arena == NULL) die("realloc");
+    }
+    r = &E.grep.r[E.grep.n++];
+    r->file = file;
+    r->line = line;
+    r->col = col;
+    r->text = E.grep.used;
+    memcpy(&E.grep.arena[E.grep.used], text, len);
+    E.grep.arena[E.grep.used + len] = '\0';
+    E.grep.used += len + 1;
+}
+
+/*
+ * Search one file, adding a result per matching line.
+ * Files with a NUL byte near the start are taken as binary and skipped.
+ */
+void editorGrepFile(int file, const char *pattern, size_t patlen) {
+    const char *path = &E.files.arena[E.files.off[file]];
+    struct stat st;
+    const char *map, *pos, *end, *hit;
+    int fd = open(path, O_RDONLY), line = 0;
+
+    if (fd == -1) return;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    end = map + st.st_size;
+    if (memchr(map, '\0', st.st_size < 1024 ? st.st_size : 1024) == NULL) {
+        pos = map;
+        while ((hit = memmem(pos, end - pos, pattern, patlen)) != NULL) {
+            const char *nl, *bol = pos, *eol;
+            // count the lines skipped over, remembering where the hit's line starts
+            while ((nl = memchr(bol, '\n', hit - bol)) != NULL) {
+                line++;
+                bol = nl + 1;
+            }
+            eol = memchr(hit, '\n', end - hit);
+            if (eol == NULL) eol = end;
+            editorGrepAdd(file, line, hit - bol, bol, eol > bol && eol[-1] == '\r' ? eol - bol - 1 : eol - bol);
+            if (eol == end) break;
+            pos = eol + 1;
+            line++;
+        }
+    }
+    munmap((void *)map, st.st_size);
+}
+
+void editorGrepShow() {
+    E.grep.savedcx = E.cx;
+    E.grep.savedcy = E.cy;
+    E.grep.savedrowoff = E.rowoff;
+    E.grep.active = 1;
+    E.cx = E.cy = E.rowoff = E.coloff = 0;
+}
+
+void editorGrepClose() {
+    E.grep.active = 0;
+    E.cx = E.grep.savedcx;
+    E.cy = E.grep.savedcy;
+    E.rowoff = E.grep.savedrowoff;
+}
+
+/*
+ * Ctrl-G: search the project. Enter on an empty pattern brings back the
+ * results of the last search.
+ */
+void editorGrep() {
+    char *pattern = editorPrompt("Search project (Enter for last results): %s", NULL);
+    int i;
+
+    if (pattern == NULL) return;
+    if (pattern[0] == '\0') {
+        free(pattern);
+        if (E.grep.pattern) editorGrepShow();
+        return;
+    }
+
+    if (!E.files.built) {
+        editorFilesLoadIgnore();
+        editorFilesWalk("");
+        E.files.built = 1;
+    }
+    free(E.grep.pattern);
+    E.grep.pattern = pattern;
+    E.grep.n = 0;
+    E.grep.used = 0;
+    editorGrepShow();
+    for (i = 0; i < E.files.n; i++) {
+        editorGrepFile(i, pattern, strlen(pattern));
+        if (i % GREP_REFRESH == GREP_REFRESH - 1) editorRefreshScreen();
+    }
+}
+
+void editorGrepDrawRow(struct abuf *ab, int r) {
+    struct grepResult *res;
+    char prefix[PATH_MAX + 32];
+    int plen, len;
+    const char *text;
+
+    if (r >= E.grep.n) {
+        abAppend(ab, "~", 1);
+        return;
+    }
+    res = &E.grep.r[r];
+    plen = snprintf(prefix, sizeof(prefix), "%s:%d: ", &E.files.arena[E.files.off[res->file]], res->line + 1);
+    if (plen > E.screencols) plen = E.screencols;
+    text = &E.grep.arena[res->text];
+    len = strlen(text);
+    if (len > E.screencols - plen) len = E.screencols - plen;
+
+    if (r == E.cy) abAppend(ab, "\x1b[7m", 4);
+    abAppend(ab, "\x1b[35m", 5);
+    editorDrawText(ab, prefix, plen);
+    abAppend(ab, "\x1b[39m", 5);
+    editorDrawText(ab, text, len);
+    if (r == E.cy) abAppend(ab, "\x1b[m", 3);
+}
+
+/*
+ * Open the file of the result under the cursor at the line and column of the hit.
+ */
+void editorGrepOpen() {
+    struct grepResult *res;
+    char *path;
+
+    if (E.cy >= E.grep.n) return;
+    res = &E.grep.r[E.cy];
+    path = strdup(&E.files.arena[E.files.off[res->file]]);
+    editorGrepClose();
+    if (E.filename == NULL || strcmp(E.filename, path) != 0) editorOpenReplace(path);
+    free(path);
+    if (E.filename == NULL || strcmp(E.filename, &E.files.arena[E.files.off[res->file]]) != 0) return;
+    editorGotoLine(res->line, res->col);
+}
+
+void editorGrepProcessKey(int c) {
+    int times;
+
+    switch (c) {
+        case CTRL_KEY('q'):
+            write(STDOUT_FILENO, "\x1b[2J", 4);
+            write(STDOUT_FILENO, "\x1b[H", 3);
+            exit(0);
+            break;
+
+        case '\x1b':
+            editorGrepClose();
+            break;
+
+        case '\r':
+            editorGrepOpen();
+            break;
+
+        case 'j':
+        case ARROW_UP:
+            if (E.cy > 0) E.cy--;
+            break;
+
+        case 'k':
+        case ARROW_DOWN:
+            if (E.cy < E.grep.n - 1) E.cy++;
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN:
+            times = E.screenrows;
+            while (times--) editorGrepProcessKey(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+            break;
+    }
+}
+
+/*** tags ***/
+
+/*
+ * Ctrl-] jumps to the definition of the word under the cursor using a
+ * ctags file (./tags, or $KILO_TAGS). The file is mmap'd the first time it
+ * is needed and binary searched where it lies: ctags keeps it sorted by
+ * tag name, so a lookup touches O(log n) lines and nothing is parsed up front.
+ * Ctrl-T goes back to where the jump was made from.
+ */
+
+int editorTagsMap() {
+    const char *path = getenv("KILO_TAGS");
+    struct stat st;
+    int fd;
+
+    if (E.tags.map) return 0;
+    fd = open(path ? path : "tags", O_RDONLY);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    E.tags.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (E.tags.map == MAP_FAILED) {
+        E.tags.map = NULL;
+        return -1;
+    }
+    E.tags.size = st.st_size;
+    return 0;
+}
 
-    /*
-     * Control flags (c_cflag):
-     *  - CS8: set character size to 8 bits per byte (standard)
-     */
-    raw.c_cflag |= (CS8);
+size_t editorTagsLineStart(size_t off) {
+    while (off > 0 && E.tags.map[off - 1] != '\n') off--;
+    return off;
+}
 
-    /*
-     * Local flags (c_lflag):
-     *  - ECHO: disable echoing input characters to the screen
-     *  - ICANON: disable canonical mode (so input is read byte-by-byte)
-     *  - IEXTEN: disable Ctrl-V and other extended input processing
-     *  - ISIG: disable signal generation from keys like Ctrl-C (SIGINT), Ctrl-Z (SIGTSTP)
-     */
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+size_t editorTagsLineEnd(size_t off) {
+    const char *nl = memchr(&E.tags.map[off], '\n', E.tags.size - off);
+    return nl ? (size_t)(nl - E.tags.map) : E.tags.size;
+}
 
-    /*
-     * Control characters (c_cc):
-     *  - VMIN = 0: read returns as soon as there's any input (non-blocking read)
-     *  - VTIME = 1: set a 100ms timeout for read()
-     *    This allows read to block briefly and return if no input is given,
-     *    so we don't burn CPU in a tight polling loop.
-     */
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+/*
+ * Compare the tag name of the line at off (up to the first tab) with word.
+ */
+int editorTagsCmp(size_t off, const char *word, int len) {
+    const char *s = &E.tags.map[off];
+    size_t avail = E.tags.size - off;
+    int i;
 
-    // Apply the modified attributes immediately
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+    for (i = 0; i < len; i++) {
+        if ((size_t)i >= avail || s[i] == '\t' || s[i] == '\n') return -1;
+        if (s[i] != word[i]) return (unsigned char)s[i] - (unsigned char)word[i];
+    }
+    return ((size_t)i < avail && s[i] != '\t' && s[i] != '\n') ? 1 : 0;
 }
 
-/* Wait for one keypress and return it
- * <Currently cannot handle multi-byte things like Arrow keys>
+/*
+ * Offset of the first line whose tag is word, or -1.
  */
-char editorReadKey() {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) die("read");
+long editorTagsFind(const char *word, int len) {
+    size_t lo = 0, hi = E.tags.size;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t line = editorTagsLineStart(mid);
+        if (line < lo) line = lo;
+        if (editorTagsCmp(line, word, len) < 0)
+            lo = editorTagsLineEnd(line) + 1;
+        else
+            hi = line;
     }
+    if (lo >= E.tags.size || editorTagsCmp(lo, word, len) != 0) return -1;
+    return lo;
+}
 
-    if (c == '\x1b') {
-        char seq[3];  // grab value after escape sequence
+/*
+ * Find the line an ex address from a tags file points at: a line number,
+ * or a /^pattern$/ search (the anchors are optional, \/ is an escaped /).
+ */
+int editorTagsAddress(const char *addr, const char *end) {
+    char pat[1024];
+    int len = 0, bol = 0, eol = 0, i;
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+    if (isdigit((unsigned char)*addr)) return atoi(addr) - 1;
+    if (*addr != '/' && *addr != '?') return -1;
+    addr++;
+    if (addr < end && *addr == '^') {
+        bol = 1;
+        addr++;
+    }
+    while (addr < end && *addr != '/' && *addr != '?' && len < (int)sizeof(pat) - 1) {
+        if (*addr == '\\' && addr + 1 < end) addr++;
+        pat[len++] = *addr++;
+    }
+    if (len > 0 && pat[len - 1] == '$' && (addr >= end || *addr == '/' || *addr == '?')) {
+        eol = 1;
+        len--;
+    }
 
-        if (seq[0] == '[') {
-            switch (seq[1]) {
-                case 'A':
-                    return 'j';
-                case 'B':
-                    return 'k';
-                case 'C':
-                    return 'l';
-                case 'D':
-                    return 'h';
-            }
+    for (i = 0; i < E.numrows; i++) {
+        erow *row = &E.row[i];
+        if (bol && eol) {
+            if (row->size == len && memcmp(row->chars, pat, len) == 0) return i;
+        } else if (bol) {
+            if (row->size >= len && memcmp(row->chars, pat, len) == 0) return i;
+        } else if (memmem(row->chars, row->size, pat, len)) {
+            return i;
         }
+    }
+    return -1;
+}
 
-        return '\x1b';
-    } else {
-        return c;
+void editorTagJump() {
+    erow *row;
+    int start, end, line, pushed = 0;
+    long off;
+    size_t eol;
+    const char *file, *fileend, *addr;
+    char path[PATH_MAX];
+
+    if (E.cy >= editorVisibleRows() || editorTagsMap() == -1) return;
+    row = &E.row[editorRowToLine(E.cy)];
+    start = end = E.cx;
+    while (start > 0 && editorIsWordChar((unsigned char)row->chars[start - 1])) start--;
+    while (end < row->size && editorIsWordChar((unsigned char)row->chars[end])) end++;
+    if (start == end) return;
+
+    if ((off = editorTagsFind(&row->chars[start], end - start)) == -1) return;
+    eol = editorTagsLineEnd(off);
+    file = memchr(&E.tags.map[off], '\t', eol - off);
+    if (file == NULL) return;
+    file++;
+    fileend = memchr(file, '\t', &E.tags.map[eol] - file);
+    if (fileend == NULL || fileend - file >= (long)sizeof(path)) return;
+    memcpy(path, file, fileend - file);
+    path[fileend - file] = '\0';
+    addr = fileend + 1;
+
+    // remember where we are for Ctrl-T
+    if (E.tags.depth < TAG_STACK_MAX) {
+        struct tagPos *pos = &E.tags.stack[E.tags.depth++];
+        pos->filename = E.filename ? strdup(E.filename) : NULL;
+        pos->line = editorRowToLine(E.cy);
+        pos->col = E.cx;
+        pushed = 1;
     }
+
+    if (E.filename == NULL || strcmp(E.filename, path) != 0) editorOpenReplace(path);
+    if (E.filename == NULL || strcmp(E.filename, path) != 0) {
+        if (pushed) free(E.tags.stack[--E.tags.depth].filename);  // we never left
+        return;
+    }
+    line = editorTagsAddress(addr, &E.tags.map[eol]);
+    editorGotoLine(line, 0);
 }
 
-int getCursorPosition(int *rows, int *cols) {
-    char buf[32];
-    unsigned int i = 0;
+void editorTagPop() {
+    struct tagPos *pos;
 
-    if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
+    if (E.tags.depth == 0) return;
+    pos = &E.tags.stack[--E.tags.depth];
+    if (pos->filename && (E.filename == NULL || strcmp(E.filename, pos->filename) != 0))
+        editorOpenReplace(pos->filename);
+    if (pos->filename && E.filename && strcmp(E.filename, pos->filename) == 0) editorGotoLine(pos->line, pos->col);
+    free(pos->filename);
+}
 
-    while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
-        if (buf[i] == 'R') break;
-        i++;
+/*** output ***/
+
+/*
+ * Keep the cursor inside the window by moving rowoff/coloff
+ */
+void editorScroll() {
+    int textcols = E.screencols - E.gutter - E.mapwidth;
+    if (E.cy < E.rowoff) E.rowoff = E.cy;
+    if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
+    if (E.cx < E.coloff) E.coloff = E.cx;
+    if (E.cx >= E.coloff + textcols) E.coloff = E.cx - textcols + 1;
+}
+
+/*
+ * Append len bytes of a row, showing tabs as a space and other control
+ * characters as '?' so they can't mess with the terminal.
+ * Printable runs go into the buffer with a single abAppend().
+ */
+void editorDrawText(struct abuf *ab, const char *s, int len) {
+    int i, start = 0;
+    for (i = 0; i < len; i++) {
+        if (!iscntrl((unsigned char)s[i])) continue;
+        abAppend(ab, &s[start], i - start);
+        abAppend(ab, s[i] == '\t' ? " " : "?", 1);
+        start = i + 1;
     }
-    buf[i] = '\0';
+    abAppend(ab, &s[start], len - start);
+}
 
-    if (buf[0] != '\x1b' || buf[1] != '[') return -1;
-    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
+/*
+ * Write screen row y, unless the terminal already shows exactly that: each
+ * row's bytes (escape sequences included) are hashed and compared with
+ * what was written there last frame. Moving the cursor, typing and most
+ * edits only change a row or two, and only those go out.
+ */
+void editorDrawLine(struct abuf *ab, int y, int col, struct abuf *line) {
+    uint64_t h = editorHashLine(line->b, line->len);
+    char pos[32];
 
-    return -1;
+    if (E.drawnvalid && E.drawn[y] == h) return;
+    E.drawn[y] = h;
+    snprintf(pos, sizeof(pos), "\x1b[%d;%dH", y + 1, col + 1);
+    abAppend(ab, pos, strlen(pos));
+    abAppend(ab, line->b, line->len);
+    abAppend(ab, "\x1b[K", 3);  // clear the rest of the line (erase in line)
 }
+
+static const char digitPairs[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
 /*
- * Get window size col and row
+ * Write n right-aligned into the width bytes ending at out + width, two
+ * digits at a time from a table instead of one division per digit.
+ * Returns how many digits it took.
  */
-int getWindowSize(int *rows, int *cols) {
-    struct winsize ws;
+int editorFormatNumber(char *out, int width, unsigned int n) {
+    char *p = out + width;
 
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-        if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
-            return -1;  // https://vt100.net/docs/vt100-ug/chapter3.html#CUD
-        return getCursorPosition(rows, cols);
+    while (n >= 100) {
+        const char *d = &digitPairs[(n % 100) * 2];
+        n /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (n >= 10) {
+        *--p = digitPairs[n * 2 + 1];
+        *--p = digitPairs[n * 2];
     } else {
-        *cols = ws.ws_col;
-        *rows = ws.ws_row;
-        return 0;
+        *--p = '0' + n;
     }
+    return out + width - p;
 }
 
-/*** append buffer ***/
+/*
+ * Columns for line numbers up to numrows and a space, at least 4 like vim.
+ */
+int editorNumberWidth() {
+    char buf[GUTTER_MAX];
+    int digits = editorFormatNumber(buf, sizeof(buf), E.numrows);
+    return (digits < 3 ? 3 : digits) + 1;
+}
 
 /*
- * Replace write() calls with code that appends the string to a buffer, then writes
- * Prevents flicker affect with multiple write calls for all the ~ and whatever we are typing
+ * The line number cells of screen row y, n < 0 for a row past the end.
+ * The cells are compared one by one with what the row got last frame
+ * and only the changed span is written: with relative numbers every j/k
+ * renumbers the whole screen, but mostly just the last digit changes.
  */
+void editorDrawGutter(struct abuf *ab, int y, int n) {
+    char cells[GUTTER_MAX], pos[32], *old = &E.gutterdrawn[y * GUTTER_MAX];
+    int w = E.numwidth, first = 0, last = w - 1;
 
-struct abuf {
-    char *b;
-    int len;
-};
+    memset(cells, ' ', w);
+    if (n >= 0) editorFormatNumber(cells, w - 1, n);
+    if (E.drawnvalid) {
+        while (first < w && cells[first] == old[first]) first++;
+        if (first == w) return;
+        while (cells[last] == old[last]) last--;
+    }
+    memcpy(old, cells, w);
+    snprintf(pos, sizeof(pos), "\x1b[%d;%dH\x1b[33m", y + 1, first + 1);
+    abAppend(ab, pos, strlen(pos));
+    abAppend(ab, &cells[first], last - first + 1);
+    abAppend(ab, "\x1b[39m", 5);
+}
+
+/*
+ * Reformat seg if any of its inputs differ from the ones its text was made from.
+ */
+void editorSegment(struct statusSegment *seg, long long a, long long b, long long c, long long d, long long e,
+                   const char *fmt, ...) {
+    long long in[5];
+    va_list ap;
 
-#define ABUF_INIT {NULL, 0}
+    in[0] = a;
+    in[1] = b;
+    in[2] = c;
+    in[3] = d;
+    in[4] = e;
+    if (seg->made && memcmp(seg->in, in, sizeof(in)) == 0) return;
+    memcpy(seg->in, in, sizeof(in));
+    seg->made = 1;
+    va_start(ap, fmt);
+    seg->len = vsnprintf(seg->text, sizeof(seg->text), fmt, ap);
+    va_end(ap);
+    if (seg->len >= (int)sizeof(seg->text)) seg->len = sizeof(seg->text) - 1;
+}
 
 /*
- * Allocate anough memory via realloc (grow current stack, or free and alloc new size)
- * to hold current string, and what we are appending
- * Use memcpy copy the string after end of current data in buffer then update *ptr and len
+ * File name, mode and language server on the left, counts and position on
+ * the right, in inverse video. Segments are only reformatted when what
+ * they show changed, the bar itself is just their bytes put together.
  */
-void abAppend(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b, ab->len + len);
+void editorDrawStatusBar(struct abuf *out) {
+    struct statusSegment *seg = E.status.seg;
+    struct abuf *line = &E.line;
+    const char *name = E.filename ? E.filename : "[No Name]";
+    int nrows = editorVisibleRows();
+    int lineno = E.cy < nrows ? editorRowToLine(E.cy) + 1 : 0;
+    int left, right, stats, i;
 
-    if (new == NULL) return;
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
+    line->len = 0;
+    editorSegment(&seg[SEG_FILE], editorHashLine(name, strlen(name)), E.dirty > 0, 0, 0, 0, "%.40s%s", name,
+                  E.dirty ? " [+]" : "");
+    editorSegment(&seg[SEG_MODE], E.mode, E.pipe.pid > 0, 0, 0, 0, "%s%s", E.mode == MODE_INSERT ? "INSERT" : "NORMAL",
+                  E.pipe.pid > 0 ? " | piping" : "");
+    if (E.lsp.pid > 0)
+        editorSegment(&seg[SEG_LSP], 1, E.lsp.diagnostics, 0, 0, 0, "%d diagnostics", E.lsp.diagnostics);
+    else
+        editorSegment(&seg[SEG_LSP], 0, 0, 0, 0, 0, "");
+    if (E.stats.show)
+        editorSegment(&seg[SEG_STATS], E.numrows, E.stats.words, E.stats.chars, E.stats.bytes, 1,
+                      "%d lines  %lld words  %lld chars  %lld bytes", E.numrows, E.stats.words,
+                      E.stats.chars + E.numrows, E.stats.bytes + E.numrows);
+    else
+        editorSegment(&seg[SEG_STATS], 0, 0, 0, 0, 0, "");
+    editorSegment(&seg[SEG_POS], lineno, E.cx, E.numrows, 0, 0, "%d:%d/%d", lineno, E.cx + 1, E.numrows);
+
+    left = 1 + seg[SEG_FILE].len + 2 + seg[SEG_MODE].len + (seg[SEG_LSP].len ? 2 + seg[SEG_LSP].len : 0);
+    right = seg[SEG_POS].len + 1;
+    stats = seg[SEG_STATS].len && left + right + seg[SEG_STATS].len + 2 <= E.screencols;  // the first to go
+    if (stats) right += seg[SEG_STATS].len + 2;
+
+    abAppend(line, "\x1b[7m ", 5);
+    abAppend(line, seg[SEG_FILE].text, seg[SEG_FILE].len);
+    abAppend(line, "  ", 2);
+    abAppend(line, seg[SEG_MODE].text, seg[SEG_MODE].len);
+    if (seg[SEG_LSP].len) {
+        abAppend(line, "  ", 2);
+        abAppend(line, seg[SEG_LSP].text, seg[SEG_LSP].len);
+    }
+    if (left + right <= E.screencols) {
+        for (i = left; i < E.screencols - right; i++) abAppend(line, " ", 1);
+        if (stats) {
+            abAppend(line, seg[SEG_STATS].text, seg[SEG_STATS].len);
+            abAppend(line, "  ", 2);
+        }
+        abAppend(line, seg[SEG_POS].text, seg[SEG_POS].len);
+        abAppend(line, " ", 1);
+    } else {
+        // too narrow for both sides: cut the left one, the terminal would wrap it
+        line->len = 4 + (left < E.screencols ? left : E.screencols);
+        for (i = left; i < E.screencols; i++) abAppend(line, " ", 1);
+    }
+    abAppend(line, "\x1b[m", 3);
+    editorDrawLine(out, E.screenrows, 0, line);
 }
+
 /*
- * Free our struct after we are done, always clean your messes
+ * The prompt while one is open, else the last message for 5 seconds.
  */
-void abFree(struct abuf *ab) { free(ab->b); }
+void editorDrawMessageBar(struct abuf *out) {
+    struct abuf *line = &E.line;
+    const char *msg = E.prompt;
+    int len;
 
-/*** output ***/
+    line->len = 0;
+    if (msg == NULL && E.status.msg[0] && time(NULL) - E.status.msgtime < 5) msg = E.status.msg;
+    if (msg) {
+        len = strlen(msg);
+        abAppend(line, msg, len < E.screencols ? len : E.screencols);
+    }
+    editorDrawLine(out, E.screenrows + 1, 0, line);
+}
+
+void editorSetStatusMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.status.msg, sizeof(E.status.msg), fmt, ap);
+    va_end(ap);
+    E.status.msgtime = time(NULL);
+}
 
 /*
- * Write column of ~ like vim
+ * Write the visible rows of the file (or of the filtered view),
+ * and a column of ~ like vim past the end of it
  */
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(struct abuf *out) {
     int y;
+    int nrows = editorVisibleRows();
+    struct abuf *ab = &E.line;
     for (y = 0; y < E.screenrows; y++) {
-        if (y == E.screenrows / 3) {
-            char welcome[80];
-            int welcomelen = snprintf(welcome, sizeof(welcome), "RyeRye editor --version %s", RYEDOC_VERSION);
-            if (welcomelen > E.screencols) welcomelen = E.screencols;
-            int padding = (E.screencols - welcomelen) / 2;
-            if (padding) {
+        int vrow = y + E.rowoff;
+        ab->len = 0;
+        if (E.picker.active) {
+            editorPickerDrawRow(ab, y);
+        } else if (E.grep.active) {
+            editorGrepDrawRow(ab, vrow);
+        } else if (E.sbs.active) {
+            if (vrow < E.sbs.nrows)
+                editorSbsDrawRow(ab, vrow);
+            else
+                abAppend(ab, "~", 1);
+        } else if (E.json.active) {
+            if (vrow < E.json.len)
+                editorJsonDrawLine(ab, vrow);
+            else
+                abAppend(ab, "~", 1);
+        } else if (vrow >= nrows) {
+            if (E.numrows == 0 && y == E.screenrows / 3) {
+                char welcome[80];
+                int welcomelen = snprintf(welcome, sizeof(welcome), "RyeRye editor --version %s", RYEDOC_VERSION);
+                if (welcomelen > E.screencols) welcomelen = E.screencols;
+                int padding = (E.screencols - welcomelen) / 2;
+                if (padding) {
+                    abAppend(ab, "~", 1);
+                    padding--;
+                }
+                while (padding--) abAppend(ab, " ", 1);
+                abAppend(ab, welcome, welcomelen);
+            } else {
                 abAppend(ab, "~", 1);
-                padding--;
             }
-            while (padding--) abAppend(ab, " ", 1);
-            abAppend(ab, welcome, welcomelen);
         } else {
-            abAppend(ab, "~", 1);
+            int line = editorRowToLine(vrow);
+            int textcols = E.screencols - E.gutter - E.mapwidth;
+            erow *row = &E.row[line];
+            int len = row->size - E.coloff;
+            if (len < 0) len = 0;
+            if (len > textcols) len = textcols;
+
+            if (E.diff.active) {
+                // green for added, yellow for changed, red for deleted
+                char mark = E.diff.marks[line];
+                const char *color = mark == '+' ? "\x1b[32m" : mark == '~' ? "\x1b[33m" : "\x1b[31m";
+                abAppend(ab, color, 5);
+                abAppend(ab, &mark, 1);
+                abAppend(ab, "\x1b[39m ", 6);
+            }
+            if (E.spell.show)
+                editorSpellDrawText(ab, row, len ? E.coloff : 0, len);
+            else
+                editorDrawText(ab, &row->chars[len ? E.coloff : 0], len);
+
+            int fold = E.view.active ? -1 : editorFoldAt(line);
+            if (fold != -1) {
+                char marker[32];
+                int mlen = snprintf(marker, sizeof(marker), " +-- %d lines", fold - line);
+                if (mlen > textcols - len) mlen = textcols - len;
+                abAppend(ab, marker, mlen);
+            }
         }
 
-        abAppend(ab, "\x1b[K", 3);  // clear each line (erase in line)
-        if (y < E.screenrows - 1) {
-            abAppend(ab, "\r\n", 2);
+        if (E.mapwidth) {
+            char col[32];
+            snprintf(col, sizeof(col), "\x1b[K\x1b[%dG", E.screencols - E.mapwidth + 1);  // clear up to the map
+            abAppend(ab, col, strlen(col));
+            editorMinimapDrawRow(ab, y);
+        }
+        editorDrawLine(out, y, E.numwidth, ab);
+        if (E.numwidth) {
+            int n = -1;
+            if (vrow < nrows) n = E.numbers == 1 ? editorRowToLine(vrow) + 1 : abs(vrow - E.cy);
+            editorDrawGutter(out, y, n);
         }
     }
 }
@@ -265,45 +6423,130 @@ void editorDrawRows(struct abuf *ab) {
  * move.
  * */
 void editorRefreshScreen() {
-    struct abuf ab = ABUF_INIT;
+    uint64_t start = editorTraceNow(), t = start;
+    editorDiffRefresh();
+    editorTraceSpan("diff", t);
+    t = editorTraceNow();
+    int numwidth = 0;
+    if (E.numbers && !E.json.active && !E.grep.active && !E.sbs.active && !E.picker.active)
+        numwidth = editorNumberWidth();
+    if (numwidth != E.numwidth) E.drawnvalid = 0;  // every row moves sideways
+    E.numwidth = numwidth;
+    E.gutter = E.numwidth + ((E.diff.active && !E.json.active && !E.grep.active) ? 2 : 0);
+    E.mapwidth = 0;
+    if (E.minimap.show && !E.json.active && !E.grep.active && !E.sbs.active && !E.picker.active)
+        E.mapwidth = MINIMAP_COLS + 1;
+    editorScroll();
+
+    struct abuf *ab = &E.frame;
+    ab->len = 0;
 
-    abAppend(&ab, "\x1[?25l", 6);  // hide cursor https://vt100.net/docs/vt510-rm/DECTCEM.html
-    abAppend(&ab, "\x1b[H", 3);
+    abAppend(ab, "\x1b[?25l", 6);  // hide cursor https://vt100.net/docs/vt510-rm/DECTCEM.html
 
-    editorDrawRows(&ab);
+    editorDrawRows(ab);
+    editorDrawStatusBar(ab);
+    editorDrawMessageBar(ab);
+    E.drawnvalid = 1;
 
     char buf[32];
-    // move cursor to E.cx / E.cy
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.cy + 1, E.cx + 1);
-    abAppend(&ab, buf, strlen(buf));
+    if (E.prompt) {
+        // keep the cursor at the end of what is being typed
+        int len = strlen(E.prompt);
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.screenrows + 2, (len < E.screencols ? len : E.screencols - 1) + 1);
+    } else {
+        // move cursor to E.cx / E.cy, relative to the scrolled window
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.cx - E.coloff) + E.gutter + 1);
+    }
+    abAppend(ab, buf, strlen(buf));
 
-    abAppend(&ab, "\x1b[?25h", 6);  // cursor show
+    abAppend(ab, "\x1b[?25h", 6);  // cursor show
+    editorTraceSpan("build frame", t);
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    t = editorTraceNow();
+    write(STDOUT_FILENO, ab->b, ab->len);
+    editorTraceSpan("write", t);
+    editorLatencyFrame();
+    editorTraceSpan("refresh", start);
 }
 
 /*** input ***/
 
-void editorMoveCursor(char key) {
+/*
+ * Show prompt on the last screen row and read a line of input.
+ * prompt must contain a %s where the typed text goes.
+ * callback (if not NULL) gets the text and the key after every keypress.
+ * Returns a malloc'd string on Enter, NULL if Esc cancels it.
+ */
+char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+
+    while (1) {
+        size_t promptsize = strlen(prompt) + buflen + 1;
+        E.prompt = malloc(promptsize);
+        snprintf(E.prompt, promptsize, prompt, buf);
+        editorRefreshScreen();
+        free(E.prompt);
+        E.prompt = NULL;
+
+        int c = editorReadKey();
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+            if (buflen != 0) buf[--buflen] = '\0';
+        } else if (c == '\x1b') {
+            if (callback) callback(buf, c);
+            free(buf);
+            return NULL;
+        } else if (c == '\r') {
+            if (callback) callback(buf, c);
+            return buf;
+        } else if (c < 128 && !iscntrl(c)) {
+            if (buflen == bufsize - 1) {
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+        if (callback) callback(buf, c);
+    }
+}
+
+void editorMoveCursor(int key) {
+    int nrows = editorVisibleRows();
+    erow *row = E.cy < nrows ? &E.row[editorRowToLine(E.cy)] : NULL;
+
     switch (key) {
         case 'h':
-            E.cx--;
+        case ARROW_LEFT:
+            if (E.cx > 0) E.cx--;
             break;
         case 'j':
-            E.cy--;
+        case ARROW_UP:
+            if (E.cy > 0) E.cy--;
             break;
         case 'k':
-            E.cy++;
+        case ARROW_DOWN:
+            if (E.cy < nrows - 1) E.cy++;
             break;
         case 'l':
-            E.cx++;
+        case ARROW_RIGHT:
+            if (row && E.cx < row->size) E.cx++;
             break;
     }
+
+    // snap to the end of the line when moving onto a shorter one
+    row = E.cy < nrows ? &E.row[editorRowToLine(E.cy)] : NULL;
+    int rowlen = row ? row->size : 0;
+    if (E.cx > rowlen) E.cx = rowlen;
 }
 
-void editorProcessKeypress() {
-    char c = editorReadKey();
+/*
+ * Keys that do the same thing in normal and insert mode
+ */
+void editorProcessCommonKey(int c) {
+    int nrows = editorVisibleRows();
 
     switch (c) {
         case CTRL_KEY('q'):
@@ -312,13 +6555,251 @@ void editorProcessKeypress() {
             exit(0);
             break;
 
+        case CTRL_KEY('s'):
+            editorSave();
+            break;
+
+        case CTRL_KEY('f'):
+            editorFilter();
+            break;
+
+        case CTRL_KEY('j'):
+            editorJsonOpen();
+            break;
+
+        case CTRL_KEY('d'):
+            editorDiffToggle();
+            break;
+
+        case CTRL_KEY('p'):
+            editorPickFile();
+            break;
+
+        case CTRL_KEY('g'):
+            editorGrep();
+            break;
+
+        case CTRL_KEY(']'):
+            editorTagJump();
+            break;
+
+        case CTRL_KEY('t'):
+            editorTagPop();
+            break;
+
+        case HOME_KEY:
+            E.cx = 0;
+            break;
+
+        case END_KEY:
+            if (E.cy < nrows) E.cx = E.row[editorRowToLine(E.cy)].size;
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN: {
+            int times = E.screenrows;
+            while (times--) editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+        } break;
+
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case ARROW_UP:
+        case ARROW_DOWN:
+            editorMoveCursor(c);
+            break;
+    }
+}
+
+void editorProcessKeypress() {
+    int c = editorReadKey();
+
+    if (E.sbs.active) {
+        editorSbsProcessKey(c);
+        return;
+    }
+    if (E.grep.active) {
+        editorGrepProcessKey(c);
+        return;
+    }
+    if (E.json.active) {
+        editorJsonProcessKey(c);
+        return;
+    }
+
+    if (E.mode == MODE_INSERT) {
+        if (c != CTRL_KEY('n')) editorCompleteReset();
+        switch (c) {
+            case CTRL_KEY('n'):
+                editorComplete();
+                break;
+
+            case '\x1b':
+                E.mode = MODE_NORMAL;
+                break;
+
+            case '\r':
+                editorInsertNewline();
+                break;
+
+            case BACKSPACE:
+            case CTRL_KEY('h'):
+                editorDelChar();
+                break;
+
+            case DEL_KEY: {
+                int cx = E.cx;
+                editorMoveCursor(ARROW_RIGHT);
+                if (E.cx != cx) editorDelChar();
+            } break;
+
+            default:
+                if (c == '\t' || (c < 1000 && !iscntrl(c)))
+                    editorInsertChar(c);
+                else
+                    editorProcessCommonKey(c);
+                break;
+        }
+        return;
+    }
+
+    switch (c) {
+        case 'i':
+            if (E.pipe.pid <= 0) E.mode = MODE_INSERT;  // not while lines are fed to a command
+            break;
+
+        case '!':
+            editorPipe();
+            break;
+
+        case 'W':
+            E.stats.show = !E.stats.show;
+            break;
+
+        case '#':
+            E.numbers = (E.numbers + 1) % 3;  // off, absolute, relative
+            break;
+
+        case 'M':
+            E.minimap.show = !E.minimap.show;
+            break;
+
+        case 's':
+            editorSpellToggle();
+            break;
+
+        case 'T':
+            editorTraceExport();
+            break;
+
+        case 'S':
+        case 'N':
+        case 'R':
+        case 'U':
+            editorSortLines(c);
+            break;
+
+        case ':':
+            editorExCommand();
+            break;
+
+        case 'y':
+        case 'd':
+        case 'p':
+            editorYankKey(c);
+            break;
+
+        case '\x1b':
+            editorViewClose();
+            break;
+
+        case '%':
+            editorBracketJump();
+            break;
+
+        case 'z':
+            if (!E.view.active && E.cy < editorVisibleRows()) editorFoldToggle(editorRowToLine(E.cy));
+            break;
+
         case 'h':
         case 'j':
         case 'k':
         case 'l':
             editorMoveCursor(c);
             break;
+
+        default:
+            editorProcessCommonKey(c);
+            break;
+    }
+}
+
+/*** benchmarks ***/
+
+/*
+ * Milliseconds since start, for the benchmark report
+ */
+double editorBenchMs(uint64_t start) { return (editorTraceNow() - start) / 1e6; }
+
+/*
+ * kilo -b: time the operations that get slow on big files, on a 24x80
+ * screen drawn into /dev/null, and print one "file<TAB>bench<TAB>ms" line
+ * per benchmark to stdout. No terminal is needed, so it runs from make.
+ */
+void editorBench(char *filename, const char *pattern) {
+    char *saveas;
+    uint64_t start;
+    FILE *out;
+    int fd, rows, i;
+
+    fd = dup(STDOUT_FILENO);
+    if (fd == -1 || (out = fdopen(fd, "w")) == NULL) die("dup");
+    int null = open("/dev/null", O_WRONLY);
+    if (null == -1 || dup2(null, STDOUT_FILENO) == -1) die("/dev/null");
+    close(null);
+    editorSetScreenSize(24, 80);
+
+    start = editorTraceNow();
+    editorOpen(filename);
+    editorCountPhase(COUNT_FRAME);
+    editorRefreshScreen();
+    fprintf(out, "%s\topen\t%.3f\n", filename, editorBenchMs(start));
+
+    start = editorTraceNow();
+    E.cy = editorVisibleRows() > 0 ? editorVisibleRows() - 1 : 0;
+    editorRefreshScreen();
+    fprintf(out, "%s\tend\t%.3f\n", filename, editorBenchMs(start));
+
+    start = editorTraceNow();
+    rows = editorVisibleRows();
+    for (E.cy = 0; E.cy < rows; E.cy += E.screenrows) editorRefreshScreen();
+    fprintf(out, "%s\tscroll\t%.3f\n", filename, editorBenchMs(start));
+
+    // nothing changed, so a redraw should reuse its buffers and write once
+    E.cy = 0;
+    editorRefreshScreen();
+    editorCountMark();
+    for (i = 0; i < 100; i++) {
+        editorCountPhase(COUNT_FRAME);
+        editorRefreshScreen();
     }
+    editorCountAssert("redraw", 0, 100);
+
+    start = editorTraceNow();
+    editorViewBuild(pattern);
+    fprintf(out, "%s\tsearch\t%.3f\n", filename, editorBenchMs(start));
+    editorViewClose();
+
+    saveas = malloc(strlen(filename) + 7);
+    sprintf(saveas, "%s.saved", filename);
+    free(E.filename);
+    E.filename = saveas;
+    start = editorTraceNow();
+    editorSave();
+    fprintf(out, "%s\tsave\t%.3f\n", filename, editorBenchMs(start));
+    if (E.dirty) die("save");
+    unlink(saveas);
+
+    fclose(out);
 }
 
 /*** init ***/
@@ -329,21 +6810,97 @@ void editorProcessKeypress() {
 void initEditor() {
     E.cx = 0;
     E.cy = 0;
+    E.rowoff = 0;
+    E.coloff = 0;
+    E.numrows = 0;
+    E.rowcap = 0;
+    E.row = NULL;
+    E.mode = MODE_NORMAL;
+    E.dirty = 0;
+    E.filename = NULL;
+    E.prompt = NULL;
+    memset(&E.view, 0, sizeof(E.view));
+    memset(&E.regs, 0, sizeof(E.regs));
+    E.freerefs = NULL;
+    memset(&E.json, 0, sizeof(E.json));
+    memset(&E.folds, 0, sizeof(E.folds));
+    memset(&E.brackets, 0, sizeof(E.brackets));
+    memset(&E.minimap, 0, sizeof(E.minimap));
+    memset(&E.diff, 0, sizeof(E.diff));
+    memset(&E.sbs, 0, sizeof(E.sbs));
+    memset(&E.words, 0, sizeof(E.words));
+    memset(&E.complete, 0, sizeof(E.complete));
+    memset(&E.files, 0, sizeof(E.files));
+    memset(&E.picker, 0, sizeof(E.picker));
+    memset(&E.grep, 0, sizeof(E.grep));
+    memset(&E.tags, 0, sizeof(E.tags));
+    memset(&E.stats, 0, sizeof(E.stats));
+    memset(&E.status, 0, sizeof(E.status));
+    memset(&E.spell, 0, sizeof(E.spell));
+    memset(&E.lsp, 0, sizeof(E.lsp));
+    memset(&E.pipe, 0, sizeof(E.pipe));
+    E.trace.count = 0;
+    memset(&E.latency, 0, sizeof(E.latency));
+    E.latency.on = getenv("KILO_LATENCY") != NULL;
+    E.gutter = 0;
+    E.numbers = 0;
+    E.numwidth = 0;
+    E.mapwidth = 0;
+}
 
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+/*
+ * Size the window to rows x cols terminal cells, two of which go to the
+ * status bar and message line, and forget what the screen holds.
+ */
+void editorSetScreenSize(int rows, int cols) {
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+    free(E.drawn);
+    free(E.gutterdrawn);
+    E.drawn = malloc(sizeof(uint64_t) * (E.screenrows + 2));
+    E.gutterdrawn = malloc(GUTTER_MAX * E.screenrows);
+    E.drawnvalid = 0;
+    free(E.json.text);
+    E.json.text = malloc(E.screencols + 1);
+    if (E.json.text == NULL) die("malloc");
 }
 
 /*
- * Entry point for the program. Enables raw mode and enters an input loop.
- * Pressing 'q' exits the program.
+ * Entry point for the program. Enables raw mode, opens the file given on the
+ * command line (if any) and enters an input loop.
+ * kilo -d a b compares two files side by side instead.
+ * kilo -b file [pattern] runs the I/O benchmarks on file and exits.
+ * Pressing Ctrl-Q exits the program.
  */
-int main() {
+int main(int argc, char *argv[]) {
+    int rows, cols;
+
+    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+        atexit(editorCountReport);
+        initEditor();
+        editorBench(argv[2], argc >= 4 ? argv[3] : "NEEDLE");
+        return 0;
+    }
+
+    atexit(editorCountReport);
+    atexit(editorLatencyReport);
     enableRawMode();
     initEditor();
+    if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+    editorSetScreenSize(rows, cols);
+    if (argc >= 4 && strcmp(argv[1], "-d") == 0)
+        editorSbsOpen(argv[2], argv[3]);
+    else if (argc >= 2)
+        editorOpen(argv[1]);
 
     while (1) {
+        uint64_t start;
+        editorCountPhase(COUNT_FRAME);
         editorRefreshScreen();
+        editorCountPhase(COUNT_KEY);
+        start = editorTraceNow();
         editorProcessKeypress();
+        editorTraceSpan("keypress", start);
     }
 
     return 0;
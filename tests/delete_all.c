@@ -0,0 +1,32 @@
+/*
+ * Deleting every line with the cursor below the first row, then typing,
+ * must land the character in a fresh first line. Built by "make test"
+ * against kilo.c itself, with kilo's main() renamed out of the way.
+ */
+#define main kilo_main
+#include "../kilo.c"
+#undef main
+
+static int check(const char *cmd) {
+    char buf[16];
+    int i;
+
+    editorFreeBuffer();
+    for (i = 0; i < 10; i++) editorInsertRow(i, i % 2 ? "hello" : "hi there", i % 2 ? 5 : 8);
+    E.cy = 7;
+    E.cx = 3;
+    E.rowoff = 5;
+    snprintf(buf, sizeof(buf), "%s", cmd);  // the command line is cut up in place
+    editorExRun(buf);
+    if (E.numrows != 0) return fprintf(stderr, "%s: %d lines left\n", cmd, E.numrows), 1;
+    editorInsertChar('x');
+    if (E.numrows != 1 || E.row[0].size != 1 || E.row[0].chars[0] != 'x' || E.cy != 0 || E.cx != 1)
+        return fprintf(stderr, "%s: typing after it went wrong\n", cmd), 1;
+    return 0;
+}
+
+int main() {
+    initEditor();
+    editorSetScreenSize(24, 80);
+    return check("g/h/d") | check("1,$d");
+}